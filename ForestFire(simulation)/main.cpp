@@ -6,46 +6,158 @@ Forest fire simulation
 
 #include <iostream>
 #include <ctime>
+#include <chrono>
 #include <random>
 #include <vector>
 #include <string>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "../ForestFireCore/bitgrid.h"
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/sparse_grid.h"
+#include "../ForestFireCore/replica_grid.h"
 
-#define EMPTY 0
-#define TREE 1
-#define FIRE 2
 #define ASHES 3
-#define TEMP_FIRE 4
 
+#define SCAN 0 // one full-grid sweep per step
+#define FRONTIER 1 // only visits the neighbors of the burning cells
+#define BITPLANE 2 // one bit per cell, a step is a few shifts per 64 cells
+#define REPLICAS 3 // 64 trials burnt at once, one bit of every word per trial
+#define ENGINE FRONTIER
+// 1 to generate the 64x64 tiles of the grid only when the fire reaches
+// them (frontier engine, ENGINE is then ignored), for huge grids
+#define SPARSE 0
+
+#define THREADS 0 // 0 to use all the cores
+#define MASTER_SEED 0 // 0 to seed from the time, the csv only depend on it
+
+#define SWEEP 0 // burns the grid from the center
+#define CLUSTERS 1 // labels every cluster of trees without burning
+#define THRESHOLD 2 // searches the density where the fire reaches the border
+#define MODE SWEEP
+
+#define ADAPTIVE 0 // 1 to stop each density of the sweep once it is precise enough
+#define BATCH 5 // trials added to a density at a time
+#define MIN_TRIALS 30 // before a density can stop, fewer can all miss the big fires near the threshold
+#define BURNT_ERROR 0.005 // target standard error of the burnt fraction
+#define STEPS_ERROR 0.05 // target standard error of the steps, relative to their mean
+#define MIN_STEPS_ERROR 0.5 // in steps, when the mean is close to 0
+
+#define TARGET 0.5 // probability of the fire reaching the border at the threshold
+#define CHAINS 8 // independent searches, their spread gives the error bar
+#define ITERATIONS 50 // trials of each search
+#define GAIN 0.2 // first change of the density per unit of error
 
-int height;
-int width;
-int ** grid = nullptr;
+// every worker thread owns its grid
+thread_local int height;
+thread_local int width;
+thread_local Grid grid;
+thread_local std::mt19937 rng;
 
-std::vector<std::vector<std::vector<int>>> neighbors = {
-{{-1, 0}, {0, -1}, {0, 1}, {1, 0}},
-{{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}}
+thread_local int neighborIndex; // 0=Von Neumann and 1=Moore neighbors
+// cells currently on fire (used by the frontier engine)
+thread_local std::vector<std::pair<int, int>> fireFront;
+thread_local std::vector<std::pair<int, int>> nextFront;
+thread_local BitGrid bits; // used by the bitplane engine
+thread_local SparseGrid sparse; // used with SPARSE
+thread_local ReplicaGrid replicas; // used by the replicas engine
+thread_local std::vector<int> parent; // union-find of the cluster analysis
+// trees and burnt cells inside the border, updated by the steps
+thread_local Observables observables;
+
+// one trial of the sweep
+struct Job {
+    int neighborhood;
+    int density;
+    int trial;
 };
-int neighborIndex;
 
-void init_grid(int treeOdds) {
-    grid = new int * [height];
+struct JobResult {
+    long long trees; // remaining
+    long long ashes;
+    int steps;
+    bool border; // the fire reached the border
+    long long measured; // SPARSE: trees and ashes of the generated tiles only
+};
+
+// trials of one density so far (adaptive sweep)
+struct TrialStats {
+    int neighborhood;
+    int density;
+    int trials;
+    // the burnt fraction is the ratio of the sums of the ashes and of the
+    // trees there were (ashes + remaining trees), as in write_results
+    double ashes;
+    double ashes2;
+    double forest;
+    double forest2;
+    double ashesForest;
+    double steps;
+    double steps2;
+    bool done;
+};
+
+struct ClusterResult {
+    int trees; // remaining if the center was burnt
+    int ashes; // size of the cluster of the center
+    bool spanning; // a cluster touches two opposite sides
+    int clusters;
+    int largest;
+    std::vector<std::pair<int, int>> sizes; // size, amount of clusters
+};
+
+template <class IsTree>
+void fill_grid(IsTree is_tree) {
+    // the grid is reused from one trial to the next
+    grid.init(height, width);
+    observables = Observables();
     for (int i=0; i<height; i++) {
-        grid[i] = new int [width];
         for (int j=0; j<width; j++) {
-            grid[i][j] = (rand()%100 < treeOdds) ? TREE : EMPTY;
+            grid[i][j] = is_tree() ? TREE : EMPTY;
+            if (grid[i][j] == TREE && i > 0 && i < height-1 && j > 0 && j < width-1)
+                observables.trees++;
         }
     }
+    if (grid[height/2][width/2] == TREE)
+        observables.trees--;
     grid[height/2][width/2] = FIRE;
+    observables.fires = observables.burnedArea = 1;
+    grid.sync();
+    fireFront.clear();
+    fireFront.push_back({height/2, width/2});
+}
+
+void init_grid(int treeOdds) {
+    fill_grid([treeOdds]() { return rng()%100 < (unsigned)treeOdds; });
+}
+
+void init_grid(double density) {
+    // any density between 0 and 1
+    uint64_t limit(density * 4294967296.0);
+    fill_grid([limit]() { return rng() < limit; });
 }
 
-void write_results(int density, double burnt, double steps) {
-    std::string neigType = (neighborIndex==0) ? "VonNeumann_" : "Moore_";
+void write_results(int neigI, int density, double burnt, double steps,
+                   double measuredBurnt) {
+    std::string neigType = (neigI==0) ? "VonNeumann_" : "Moore_";
     std::string fileName(std::to_string(height)+"x"+std::to_string(width));
     std::ofstream myFile(neigType + fileName + ".csv",
                          std::ios::app);
     if (myFile) {
-        myFile << density << ";" << burnt << ";" << steps << std::endl;
+        // with SPARSE the burnt fraction counts the tiles never reached for
+        // their expected trees, so its denominator is partly an estimate:
+        // density;burnt;steps;burnt over the generated tiles only
+        myFile << density << ";" << burnt << ";" << steps;
+        if (SPARSE)
+            myFile << ";" << measuredBurnt;
+        myFile << std::endl;
     }
     else {
         std::cout << "error " << fileName << std::endl;
@@ -53,85 +165,693 @@ void write_results(int density, double burnt, double steps) {
     //std::rename("result/" + fileName + ".tmp", "result/" + fileName + ".txt");
 }
 
-bool is_fire_around(int row, int col) {
-    int newR, newC;
-    for (std::vector<int> n : neighbors[neighborIndex]) {
-        if (grid[n[0]+row][n[1]+col] == FIRE)
-            return true;
+void write_adaptive_results(const TrialStats & st, double burntError,
+                            double stepsError) {
+    std::string neigType = (st.neighborhood==0) ? "VonNeumann_" : "Moore_";
+    std::string fileName(std::to_string(height)+"x"+std::to_string(width));
+    std::ofstream myFile("Adaptive_" + neigType + fileName + ".csv",
+                         std::ios::app);
+    if (!myFile) {
+        std::cout << "error " << fileName << std::endl;
+        return;
     }
-    return false;
+    // density;burnt;steps;trials;burnt 95% half-width;steps 95% half-width
+    myFile << st.density << ";" << st.ashes / st.forest << ";"
+           << st.steps / st.trials << ";" << st.trials << ";"
+           << 1.96 * burntError << ";" << 1.96 * stepsError << std::endl;
 }
 
+template <class Stencil>
+bool is_fire_around(int row, int col) {
+    return any_neighbor<Stencil>(grid, row, col, [](int state) {
+        return state == FIRE;
+    });
+}
+
+template <class Stencil>
 bool next_step() {
     bool is_any_on_fire(false); // to tell if any tree has been put on fire
-    // puts the trees on temporary fire
-    for (int r=1; r<height-1; r++) {
-        for (int c=1; c<width-1; c++) {
-            if (grid[r][c] == TREE) {
-                if (is_fire_around(r, c)) {
-                    is_any_on_fire = true;
-                    grid[r][c] = TEMP_FIRE;
-                }
-            }
-        }
-    }
-    // puts the fires in ashes and the temporary fires to fire
+    Observables changes;
+    // reads the current grid and writes the next one, the border never
+    // changes so it is the same in both
     for (int r=1; r<height-1; r++) {
+        const uint8_t * in(grid[r]);
+        uint8_t * out(grid.next(r));
         for (int c=1; c<width-1; c++) {
-            switch (grid[r][c]) {
+            switch (in[c]) {
+                case TREE:
+                    if (is_fire_around<Stencil>(r, c)) {
+                        is_any_on_fire = true;
+                        out[c] = FIRE;
+                        changes.lit++;
+                    }
+                    else
+                        out[c] = TREE;
+                    break;
                 case FIRE:
-                    grid[r][c] = ASHES;
+                    out[c] = ASHES;
+                    changes.burntOut++;
                     break;
-                case TEMP_FIRE:
-                    grid[r][c] = FIRE;
+                default:
+                    out[c] = in[c];
             }
         }
     }
+    grid.swap();
+    observables.apply(changes);
     // will return false when all fires will become ashes
     return is_any_on_fire;
 }
 
-std::vector<int> stats() {
-    // empty, tree, fire, ashes
-    std::vector<int> res(4, 0);
-    int trees, empty, ashes;
+template <class Stencil>
+bool next_step_frontier() {
+    // same rules as next_step but only the neighbors of the fires are visited
+    nextFront.clear();
+    for (const std::pair<int, int> & f : fireFront) {
+        for_each_neighbor<Stencil>(grid, f.first, f.second, [](int newR, int newC) {
+            // the border never burns, like in the scan engine
+            if (newR < 1 || newR >= height-1 || newC < 1 || newC >= width-1)
+                return;
+            // the list of fires is read, not the grid, so the new fires
+            // don't spread before the next step
+            if (grid[newR][newC] == TREE) {
+                grid[newR][newC] = FIRE;
+                nextFront.push_back({newR, newC});
+            }
+        });
+    }
+    for (const std::pair<int, int> & f : fireFront)
+        grid[f.first][f.second] = ASHES;
+    Observables changes;
+    changes.lit = nextFront.size();
+    changes.burntOut = fireFront.size();
+    observables.apply(changes);
+    fireFront.swap(nextFront);
+    // will return false when all fires will become ashes
+    return !fireFront.empty();
+}
+
+void pack_grid() {
+    // copies the grid into the bitplanes
+    if (bits.rows != height || bits.cols != width)
+        bits.resize(height, width);
+    bits.clear();
+    for (int r=0; r<height; r++) {
+        for (int c=0; c<width; c++) {
+            if (grid[r][c] == TREE)
+                bits.set(bits.tree, r, c, true);
+            else if (grid[r][c] == FIRE)
+                bits.set(bits.fire, r, c, true);
+        }
+    }
+}
+
+void seed_job(const Job & job, unsigned long long masterSeed) {
+    // the stream of a job only depends on the master seed and the job itself
+    std::seed_seq seq{(unsigned)masterSeed, (unsigned)(masterSeed >> 32),
+                      (unsigned)job.neighborhood, (unsigned)job.density,
+                      (unsigned)job.trial};
+    rng.seed(seq);
+}
+
+bool reached_border() {
+    // the border can't burn, so the cells next to it are checked
+    auto burnt = [](int r, int c) {
+        if (ENGINE == BITPLANE)
+            return bits.get(bits.ashes, r, c);
+        return grid[r][c] == ASHES;
+    };
+    for (int c=1; c<width-1; c++)
+        if (burnt(1, c) || burnt(height-2, c))
+            return true;
+    for (int r=1; r<height-1; r++)
+        if (burnt(r, 1) || burnt(r, width-2))
+            return true;
+    return false;
+}
+
+template <class Stencil>
+JobResult burn() {
+    int steps(0);
+    if (ENGINE == BITPLANE) {
+        pack_grid();
+        while (bits.burn_step(neighborIndex == 1))
+            steps++;
+        return {(long long)bits.count_interior(bits.tree),
+                (long long)bits.count_interior(bits.ashes), steps, reached_border()};
+    }
+    // the replicas engine only burns the trials of the sweep together
+    if (ENGINE == FRONTIER || ENGINE == REPLICAS) {
+        while (next_step_frontier<Stencil>())
+            steps++;
+    }
+    else {
+        while (next_step<Stencil>())
+            steps++;
+    }
+    // no fire is left, every cell that caught fire is ashes
+    return {observables.trees, observables.burnedArea, steps,
+            reached_border()};
+}
+
+template <class Stencil>
+JobResult burn_tiles(double density) {
+    // same rules as next_step_frontier, the grid is never filled
+    sparse.init(height, width, density, (uint64_t)rng() << 32 | rng());
+    auto on_border = [](int r, int c) {
+        return r == 1 || r == height-2 || c == 1 || c == width-2;
+    };
+    uint8_t & center(sparse.cell(height/2, width/2));
+    long long centerTree(center == TREE);
+    center = FIRE;
+    fireFront.clear();
+    fireFront.push_back({height/2, width/2});
+    long long ashes(1);
+    int steps(0);
+    bool border(on_border(height/2, width/2));
+    const int (*offsets)[2](Stencil::offsets(0));
+    while (true) {
+        nextFront.clear();
+        for (const std::pair<int, int> & f : fireFront) {
+            for (int n=0; n<Stencil::size; n++) {
+                int newR(f.first + offsets[n][0]);
+                int newC(f.second + offsets[n][1]);
+                if (newR < 1 || newR >= height-1 || newC < 1 || newC >= width-1)
+                    continue;
+                uint8_t & state(sparse.cell(newR, newC));
+                if (state == TREE) {
+                    state = FIRE;
+                    nextFront.push_back({newR, newC});
+                    border |= on_border(newR, newC);
+                }
+            }
+        }
+        for (const std::pair<int, int> & f : fireFront)
+            sparse.cell(f.first, f.second) = ASHES;
+        ashes += nextFront.size();
+        fireFront.swap(nextFront);
+        if (fireFront.empty())
+            break;
+        steps++;
+    }
+    // the tiles never reached count for their expected amount of trees
+    long long untouched((long long)(height-2) * (width-2) - sparse.generatedCells);
+    long long measured(sparse.generatedTrees - centerTree + 1);
+    long long trees(measured - ashes + std::llround(density * untouched));
+    return {trees, ashes, steps, border, measured};
+}
+
+JobResult burn_sparse(double density) {
+    if (neighborIndex == 1)
+        return burn_tiles<Moore>(density);
+    return burn_tiles<VonNeumann>(density);
+}
+
+JobResult run_job(int h, int w, const Job & job) {
+    height = h;
+    width = w;
+    neighborIndex = job.neighborhood;
+    if (SPARSE)
+        return burn_sparse(job.density / 100.0);
+    init_grid(job.density);
+    if (neighborIndex == 1)
+        return burn<Moore>();
+    return burn<VonNeumann>();
+}
+
+void run_replicas(int h, int w, const std::vector<Job> & jobs, int first,
+                  int count, unsigned long long masterSeed,
+                  std::vector<JobResult> & results) {
+    // the jobs first to first+count-1 (same neighborhood and density) in
+    // the bits of one grid, each one filled with the numbers of its own
+    // stream like in the other engines so the results are the same
+    height = h;
+    width = w;
+    replicas.resize(h, w);
+    for (int k=0; k<count; k++) {
+        seed_job(jobs[first + k], masterSeed);
+        uint64_t bit(1ULL << k);
+        for (int i=0; i<height; i++) {
+            uint64_t * t(replicas.row(replicas.tree, i));
+            for (int j=0; j<width; j++)
+                if (rng()%100 < (unsigned)jobs[first + k].density)
+                    t[j] |= bit;
+        }
+    }
+    uint64_t all(count < 64 ? (1ULL << count) - 1 : ~0ULL);
+    replicas.row(replicas.tree, height/2)[width/2] = 0;
+    replicas.row(replicas.fire, height/2)[width/2] = all;
+    std::vector<int> steps(REPLICAS_AMOUNT, 0);
+    bool moore(jobs[first].neighborhood == 1);
+    for (uint64_t alive=replicas.burn_step(moore); alive; alive=replicas.burn_step(moore))
+        for (uint64_t word=alive; word; word &= word - 1)
+            steps[__builtin_ctzll(word)]++;
+    std::vector<long long> trees(replicas.count(replicas.tree, true));
+    std::vector<long long> ashes(replicas.count(replicas.ashes, true));
+    uint64_t border(replicas.next_to_border(replicas.ashes));
+    for (int k=0; k<count; k++)
+        results[first + k] = {trees[k], ashes[k], steps[k], (bool)((border >> k) & 1)};
+}
+
+int find_root(int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+void union_cells(int a, int b) {
+    a = find_root(a);
+    b = find_root(b);
+    if (a != b)
+        parent[std::max(a, b)] = std::min(a, b);
+}
+
+template <class Stencil>
+ClusterResult label_clusters() {
+    // the center fire is a tree for the labeling, the border can't burn
+    // so only the inside of the grid is labeled in one raster pass
+    parent.assign(height * width, -1);
+    for (int r=1; r<height-1; r++) {
+        for (int c=1; c<width-1; c++) {
+            if (grid[r][c] != TREE && grid[r][c] != FIRE)
+                continue;
+            int i(r*width + c);
+            parent[i] = i;
+            for_each_neighbor<Stencil>(grid, r, c, [r, c, i](int newR, int newC) {
+                // only the neighbors already visited
+                if (newR > r || (newR == r && newC > c))
+                    return;
+                if (newR < 1 || newC < 1 || newC >= width-1)
+                    return;
+                int j(newR*width + newC);
+                if (parent[j] >= 0)
+                    union_cells(i, j);
+            });
+        }
+    }
+    // sizes and sides touched by each root
+    std::vector<int> size(height * width, 0);
+    std::vector<char> sides(height * width, 0);
+    int total(0);
     for (int r=1; r<height-1; r++) {
         for (int c=1; c<width-1; c++) {
-            res[grid[r][c]]++;
+            int i(r*width + c);
+            if (parent[i] < 0)
+                continue;
+            int root(find_root(i));
+            size[root]++;
+            total++;
+            sides[root] |= (r == 1) | (r == height-2) << 1 |
+                           (c == 1) << 2 | (c == width-2) << 3;
         }
     }
+    ClusterResult res;
+    res.ashes = size[find_root(height/2*width + width/2)];
+    res.trees = total - res.ashes;
+    res.spanning = false;
+    res.clusters = 0;
+    res.largest = 0;
+    std::vector<int> histogram(total + 1, 0);
+    for (int i=0; i<height*width; i++) {
+        if (size[i] == 0)
+            continue;
+        res.clusters++;
+        res.largest = std::max(res.largest, size[i]);
+        res.spanning |= (sides[i] & 3) == 3 || (sides[i] & 12) == 12;
+        histogram[size[i]]++;
+    }
+    for (int s=1; s<=total; s++)
+        if (histogram[s])
+            res.sizes.push_back({s, histogram[s]});
     return res;
 }
 
-void launch_simulation(int h, int w, int amountOfTests, int neigI) {
+void write_clusters(int neigI, const std::vector<Job> & jobs,
+                    const std::vector<ClusterResult> & results,
+                    int amountOfTests) {
+    std::string neigType = (neigI==0) ? "VonNeumann_" : "Moore_";
+    std::string fileName(std::to_string(height)+"x"+std::to_string(width));
+    std::ofstream trialsFile("Clusters_" + neigType + fileName + ".csv",
+                             std::ios::app);
+    std::ofstream sizesFile("ClusterSizes_" + neigType + fileName + ".csv",
+                            std::ios::app);
+    if (!trialsFile || !sizesFile) {
+        std::cout << "error " << fileName << std::endl;
+        return;
+    }
+    for (std::size_t j=0; j<jobs.size(); j += amountOfTests) {
+        if (jobs[j].neighborhood != neigI)
+            continue;
+        // density;trial;burnt;spanning;clusters;largest
+        std::vector<long long> histogram;
+        for (int n=0; n<amountOfTests; n++) {
+            const ClusterResult & res(results[j+n]);
+            trialsFile << jobs[j+n].density << ";" << n << ";"
+                       << (double)res.ashes/(res.trees+res.ashes) << ";"
+                       << res.spanning << ";" << res.clusters << ";"
+                       << res.largest << std::endl;
+            for (const std::pair<int, int> & s : res.sizes) {
+                if (s.first >= (int)histogram.size())
+                    histogram.resize(s.first + 1, 0);
+                histogram[s.first] += s.second;
+            }
+        }
+        // density;size;amount of clusters over all the trials
+        for (std::size_t s=1; s<histogram.size(); s++)
+            if (histogram[s])
+                sizesFile << jobs[j].density << ";" << s << ";"
+                          << histogram[s] << std::endl;
+    }
+}
+
+void run_work_stealing(int jobsAmount, int threadsAmount,
+                       const std::function<void(int)> & task) {
+    // each worker starts with a contiguous block of jobs, takes them from
+    // the back of its own queue and steals from the front of the others
+    std::vector<std::deque<int>> queues(threadsAmount);
+    std::vector<std::mutex> locks(threadsAmount);
+    for (int j=0; j<jobsAmount; j++)
+        queues[(long long)j * threadsAmount / jobsAmount].push_back(j);
+    auto worker = [&](int id) {
+        while (true) {
+            int job(-1);
+            for (int k=0; k<threadsAmount && job < 0; k++) {
+                int victim((id + k) % threadsAmount);
+                std::lock_guard<std::mutex> lock(locks[victim]);
+                if (queues[victim].empty())
+                    continue;
+                if (victim == id) {
+                    job = queues[victim].back();
+                    queues[victim].pop_back();
+                }
+                else {
+                    job = queues[victim].front();
+                    queues[victim].pop_front();
+                }
+            }
+            if (job < 0) // every queue is empty
+                break;
+            task(job);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t=1; t<threadsAmount; t++)
+        threads.push_back(std::thread(worker, t));
+    worker(0);
+    for (std::thread & t : threads)
+        t.join();
+}
+
+unsigned long long master_seed() {
+    unsigned long long masterSeed(MASTER_SEED);
+    if (masterSeed == 0)
+        masterSeed = std::time(0);
+    return masterSeed;
+}
+
+int threads_amount() {
+    int threadsAmount(THREADS);
+    if (threadsAmount <= 0)
+        threadsAmount = std::max(1u, std::thread::hardware_concurrency());
+    return threadsAmount;
+}
+
+std::vector<Job> make_jobs(int amountOfTests, std::vector<int> neighborhoods) {
+    // every (neighborhood, density, trial) is an independent job
+    std::vector<Job> jobs;
+    for (int neigI : neighborhoods)
+        for (int to=1; to < 100; to++)
+            for (int n=0; n<amountOfTests; n++)
+                jobs.push_back({neigI, to, n});
+    return jobs;
+}
+
+void launch_cluster_analysis(int h, int w, int amountOfTests,
+                             std::vector<int> neighborhoods) {
+    unsigned long long masterSeed(master_seed());
+    int threadsAmount(threads_amount());
+    std::vector<Job> jobs(make_jobs(amountOfTests, neighborhoods));
+    std::cout << jobs.size() << " grids on " << threadsAmount << " threads, "
+              << "seed " << masterSeed << std::endl;
+    std::vector<ClusterResult> results(jobs.size());
+    run_work_stealing(jobs.size(), threadsAmount, [&](int j) {
+        // same grids as the sweep with the same seed
+        seed_job(jobs[j], masterSeed);
+        height = h;
+        width = w;
+        neighborIndex = jobs[j].neighborhood;
+        init_grid(jobs[j].density);
+        if (neighborIndex == 1)
+            results[j] = label_clusters<Moore>();
+        else
+            results[j] = label_clusters<VonNeumann>();
+    });
     height = h;
     width = w;
-    neighborIndex = neigI;
-    std::vector<int> tempStats;
-    for (int to=1; to < 100; to++) {
-        std::cout << to << std::endl;
+    for (int neigI : neighborhoods)
+        write_clusters(neigI, jobs, results, amountOfTests);
+}
+
+void launch_simulation(int h, int w, int amountOfTests,
+                       std::vector<int> neighborhoods) {
+    unsigned long long masterSeed(master_seed());
+    int threadsAmount(threads_amount());
+    std::vector<Job> jobs(make_jobs(amountOfTests, neighborhoods));
+    std::cout << jobs.size() << " jobs on " << threadsAmount << " threads, "
+              << "seed " << masterSeed << std::endl;
+    std::vector<JobResult> results(jobs.size());
+    auto start(std::chrono::steady_clock::now());
+    if (ENGINE == REPLICAS && !SPARSE) {
+        // the trials of a density by groups of 64
+        std::vector<int> groups;
+        for (std::size_t j=0; j<jobs.size(); j += amountOfTests)
+            for (int n=0; n<amountOfTests; n += REPLICAS_AMOUNT)
+                groups.push_back(j + n);
+        run_work_stealing(groups.size(), threadsAmount, [&](int g) {
+            int count(std::min(REPLICAS_AMOUNT, amountOfTests - jobs[groups[g]].trial));
+            run_replicas(h, w, jobs, groups[g], count, masterSeed, results);
+        });
+    }
+    else {
+        run_work_stealing(jobs.size(), threadsAmount, [&](int j) {
+            seed_job(jobs[j], masterSeed);
+            results[j] = run_job(h, w, jobs[j]);
+        });
+    }
+    // the throughput of the whole sweep with this ENGINE and SPARSE, the
+    // bench only times the burn steps
+    std::chrono::duration<double> duration(std::chrono::steady_clock::now() - start);
+    std::cout << jobs.size() << " trials in " << duration.count() << " s, "
+              << jobs.size() / duration.count() << " trials/s" << std::endl;
+    // aggregated in the job order so the csv doesn't depend on the threads
+    for (std::size_t j=0; j<jobs.size(); j += amountOfTests) {
         double trees(0.0); // remaining
         double ashes(0.0);
+        double measured(0.0);
         double totalSteps(0);
         for (int n=0; n<amountOfTests; n++) {
-            init_grid(to);
-            int steps(0);
-            while (next_step())
-                steps++;
-            tempStats = stats();
-            trees += tempStats[TREE]; // adds the remaining trees
-            ashes += tempStats[ASHES];
-            totalSteps += steps;
+            trees += results[j+n].trees; // adds the remaining trees
+            ashes += results[j+n].ashes;
+            measured += results[j+n].measured;
+            totalSteps += results[j+n].steps;
+        }
+        height = h;
+        width = w;
+        write_results(jobs[j].neighborhood, jobs[j].density,
+                      ashes/(trees+ashes), totalSteps / amountOfTests,
+                      ashes/measured);
+    }
+}
+
+double standard_error(double sum, double sum2, int n) {
+    // of the mean, from the sample variance
+    if (n < 2)
+        return std::numeric_limits<double>::infinity();
+    double mean(sum / n);
+    double variance((sum2 - n * mean * mean) / (n - 1));
+    return std::sqrt(std::max(0.0, variance) / n);
+}
+
+double burnt_error(const TrialStats & st) {
+    // of the ratio of sums, from the sample variance of ashes - ratio*forest
+    // (delta method)
+    int n(st.trials);
+    if (n < 2 || st.forest <= 0)
+        return std::numeric_limits<double>::infinity();
+    double ratio(st.ashes / st.forest);
+    double variance((st.ashes2 - 2 * ratio * st.ashesForest
+                     + ratio * ratio * st.forest2) / (n - 1));
+    return std::sqrt(std::max(0.0, variance) / n) / (st.forest / n);
+}
+
+void launch_adaptive_simulation(int h, int w, int maxTests,
+                                std::vector<int> neighborhoods) {
+    // runs BATCH more trials of every density that isn't precise enough
+    // yet, at most maxTests per density. The trial numbers and seeds are
+    // the ones of the fixed sweep, so the results only depend on the seed.
+    unsigned long long masterSeed(master_seed());
+    int threadsAmount(threads_amount());
+    std::vector<TrialStats> stats;
+    for (int neigI : neighborhoods)
+        for (int to=1; to < 100; to++)
+            stats.push_back({neigI, to, 0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, false});
+    std::cout << "at most " << stats.size() * maxTests << " jobs on "
+              << threadsAmount << " threads, seed " << masterSeed << std::endl;
+    long long trialsAmount(0);
+    while (true) {
+        std::vector<Job> jobs;
+        std::vector<int> owner; // index in stats of each job
+        for (std::size_t s=0; s<stats.size(); s++) {
+            if (stats[s].done)
+                continue;
+            int batch(std::min(BATCH, maxTests - stats[s].trials));
+            for (int n=0; n<batch; n++) {
+                jobs.push_back({stats[s].neighborhood, stats[s].density,
+                                stats[s].trials + n});
+                owner.push_back(s);
+            }
+        }
+        if (jobs.empty())
+            break;
+        std::vector<JobResult> results(jobs.size());
+        run_work_stealing(jobs.size(), threadsAmount, [&](int j) {
+            seed_job(jobs[j], masterSeed);
+            results[j] = run_job(h, w, jobs[j]);
+        });
+        // added in the job order so the csv doesn't depend on the threads
+        for (std::size_t j=0; j<jobs.size(); j++) {
+            TrialStats & st(stats[owner[j]]);
+            double ashes(results[j].ashes);
+            double forest((double)results[j].trees + results[j].ashes);
+            st.ashes += ashes;
+            st.ashes2 += ashes * ashes;
+            st.forest += forest;
+            st.forest2 += forest * forest;
+            st.ashesForest += ashes * forest;
+            st.steps += results[j].steps;
+            st.steps2 += (double)results[j].steps * results[j].steps;
+            st.trials++;
+        }
+        trialsAmount += jobs.size();
+        for (TrialStats & st : stats) {
+            if (st.done)
+                continue;
+            double burntError(burnt_error(st));
+            double stepsError(standard_error(st.steps, st.steps2, st.trials));
+            st.done = st.trials >= maxTests ||
+                      (st.trials >= MIN_TRIALS && burntError <= BURNT_ERROR &&
+                       stepsError <= std::max(MIN_STEPS_ERROR,
+                                              STEPS_ERROR * st.steps / st.trials));
+        }
+    }
+    height = h;
+    width = w;
+    for (const TrialStats & st : stats)
+        write_adaptive_results(st, burnt_error(st),
+                               standard_error(st.steps, st.steps2, st.trials));
+    std::cout << trialsAmount << " trials instead of "
+              << stats.size() * maxTests << std::endl;
+}
+
+double run_chain(int neigI, int size, int chain,
+                 unsigned long long masterSeed) {
+    // Robbins-Monro search of the density where the fire reaches the
+    // border with the probability TARGET: after each trial the density
+    // moves by GAIN*(TARGET - reached), and the gain is divided by the
+    // amount of times the outcome flipped (Kesten), so it shrinks only once
+    // the chain oscillates around the threshold. Returns the mean of the
+    // densities over the second half of the trials.
+    double density(0.5);
+    double sum(0.0); // of the second half
+    int flips(0);
+    int last(-1);
+    height = size;
+    width = size;
+    neighborIndex = neigI;
+    for (int i=0; i<ITERATIONS; i++) {
+        std::seed_seq seq{(unsigned)masterSeed, (unsigned)(masterSeed >> 32),
+                          (unsigned)neigI, (unsigned)size,
+                          (unsigned)chain, (unsigned)i};
+        rng.seed(seq);
+        JobResult result;
+        if (SPARSE)
+            result = burn_sparse(density);
+        else {
+            init_grid(density);
+            if (neighborIndex == 1)
+                result = burn<Moore>();
+            else
+                result = burn<VonNeumann>();
+        }
+        bool reached(result.border);
+        if (last >= 0 && last != reached)
+            flips++;
+        last = reached;
+        if (i >= ITERATIONS/2)
+            sum += density;
+        density += GAIN / (1 + flips) * (TARGET - reached);
+        density = std::min(1.0, std::max(0.0, density));
+    }
+    return sum / (ITERATIONS - ITERATIONS/2);
+}
+
+void launch_threshold_search(std::vector<int> sizes,
+                             std::vector<int> neighborhoods) {
+    // every (neighborhood, size, chain) is an independent job, the
+    // threshold of a size is the mean over its chains
+    unsigned long long masterSeed(master_seed());
+    int threadsAmount(threads_amount());
+    int chainsAmount(neighborhoods.size() * sizes.size() * CHAINS);
+    std::cout << chainsAmount << " chains of " << ITERATIONS << " trials on "
+              << threadsAmount << " threads, seed " << masterSeed << std::endl;
+    std::vector<double> estimates(chainsAmount);
+    run_work_stealing(chainsAmount, threadsAmount, [&](int j) {
+        int chain(j % CHAINS);
+        int size(sizes[j / CHAINS % sizes.size()]);
+        int neigI(neighborhoods[j / CHAINS / sizes.size()]);
+        estimates[j] = run_chain(neigI, size, chain, masterSeed);
+    });
+    // written in the job order so the csv doesn't depend on the threads
+    for (std::size_t n=0; n<neighborhoods.size(); n++) {
+        for (std::size_t s=0; s<sizes.size(); s++) {
+            int neigI(neighborhoods[n]);
+            int size(sizes[s]);
+            double mean(0.0), mean2(0.0);
+            for (int chain=0; chain<CHAINS; chain++) {
+                double estimate(estimates[(n * sizes.size() + s) * CHAINS + chain]);
+                mean += estimate;
+                mean2 += estimate * estimate;
+            }
+            double error(standard_error(mean, mean2, CHAINS));
+            mean /= CHAINS;
+            std::string neigType = (neigI==0) ? "VonNeumann" : "Moore";
+            std::ofstream myFile("Threshold_" + neigType + ".csv", std::ios::app);
+            if (!myFile) {
+                std::cout << "error " << neigType << std::endl;
+                continue;
+            }
+            // size;threshold;95% half-width;trials
+            myFile << size << ";" << mean << ";" << 1.96 * error << ";"
+                   << CHAINS * ITERATIONS << std::endl;
+            std::cout << neigType << " " << size << "x" << size << ": "
+                      << mean << " +- " << 1.96 * error << std::endl;
         }
-        write_results(to, ashes/(trees+ashes), totalSteps / amountOfTests);
     }
 }
 
 int main(int argc, char** argv) {
     //system("pause");
-    std::srand(std::time(0));
     // height, width, amount of test, 0=Von Neumann and 1=Moore neighbors
-    launch_simulation(101, 101, 100, 0); 
-    launch_simulation(101, 101, 100, 1); // height, width, amount of test
+    if (MODE == CLUSTERS)
+        launch_cluster_analysis(101, 101, 100, {0, 1});
+    else if (MODE == THRESHOLD)
+        // grid sizes, 0=Von Neumann and 1=Moore neighbors
+        launch_threshold_search({51, 101, 201, 401}, {0, 1});
+    else if (ADAPTIVE)
+        launch_adaptive_simulation(101, 101, 100, {0, 1});
+    else
+        launch_simulation(101, 101, 100, {0, 1});
     return 0;
 }
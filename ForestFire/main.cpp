@@ -17,35 +17,90 @@ Forest fire simulation
 #include <fstream>
 #include <chrono>
 #include <cmath>
+#include <sstream>
+
+#include "../ForestFireCore/bitgrid.h"
+#include "../ForestFireCore/replica_grid.h"
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/texture_renderer.h"
+#include "../ForestFireCore/sim_thread.h"
+#include "../ForestFireCore/metrics.h"
+#include "../ForestFireCore/recorder.h"
+#include "../ForestFireCore/replay.h"
+#include "../ForestFireCore/time_series.h"
+#include "../ForestFireCore/band_pool.h"
+#include "../ForestFireCore/checkpoint.h"
+#include "../ForestFireCore/cluster_forest.h"
 
-#define EMPTY 0
-#define TREE 1
-#define FIRE 2
-#define NEW_EMPTY 3 // empty for the next round
-#define NEW_TREE 4 // tree for the next round
-#define NEW_FIRE 5 // fire for the next round
 #define P 100 // new tree probability 1/p
 #define F 1000 // fire probability 1/f
+#define RNG SKIP_SAMPLING // STD_RAND, SKIP_SAMPLING or COUNTER
+#define SEED 0 // 0 to seed from the time
+#define THREADS 1 // threads stepping bands of rows, 0 for all the cores
+#if THREADS != 1 && RNG != COUNTER
+#error "the threads need the random numbers of RNG COUNTER"
+#endif
+#define BOUNDARY FIXED // FIXED or PERIODIC
+#define RECTANGLES 0 // one rectangle per cell
+#define TEXTURE 1 // the whole grid in one texture
+#define RENDERER TEXTURE
 #define FIRE_PERSISTANCE 0
 #define MOORE 8
 #define VON_NEUMANN 4
+#define INT_GRID 0 // one int per cell
+#define BITPLANE 1 // one bit per cell and per state
+#define REPLICAS 2 // 64 independent grids, one bit of each word per grid
+#define EVENTS 3 // one growth or lightning at a time, a struck cluster burns at once (f << p)
+#define ENGINE INT_GRID
+#define SHOWN_REPLICA 0 // the grid drawn and counted by the replicas engine
+
+#if ENGINE != INT_GRID && FIRE_PERSISTANCE != 0
+#error "the bitplane, replicas and events engines have no fire persistance"
+#endif
+#if (ENGINE == BITPLANE || ENGINE == REPLICAS) && BOUNDARY == PERIODIC
+#error "the bitplane and replicas engines only have fixed borders"
+#endif
 
 #define ROWS 300
 #define COLUMNS 400
 #define CELL_SIZE 2
 #define FPS 30
+#define STEPS_PER_FRAME 1 // steps drawn per frame, 0 to step as fast as possible
+#define METRICS_TITLE 0 // 1 to show the metrics in the window title
+#define RECORD_EVERY 0 // records every Nth step to RECORD_FILE, 0 not to record
+#define RECORD_FILE "Forest_fire_1.ffr"
+#define KEYFRAME_INTERVAL 100 // recorded frames between two full grids
+#define TIME_SERIES 0 // 1 to write the populations of each step to TIME_SERIES_FILE
+#define TIME_SERIES_FILE "Populations_1.csv"
+#define CHECKPOINT_EVERY 0 // saves the run to CHECKPOINT_FILE every N steps, 0 never
+#define CHECKPOINT_FILE "Forest_fire_1.ckpt" // continued with --resume FILE
 
-int ** grid = nullptr;
+Grid grid;
+RandomEvents randomEvents(RNG, P, F);
+Rules rules = {FIRE_PERSISTANCE, ROWS};
+Observables observables; // updated by the steps
 int neighborsAmount;
-std::vector<std::vector<int>> neighbors;
-
-std::vector<std::vector<int>> VNNeighbors = {        {-1, 0},
-                                             {0, -1},       {0, 1},
-                                                     {1, 0}};
-
-std::vector<std::vector<int>> MNeighbors = {{-1, -1}, {-1, 0}, {-1, 1},
-                                            {0, -1},            {0, 1},
-                                            {1, -1},   {1, 0},  {1, 1}};
+TextureRenderer renderer;
+BitGrid bits(ROWS, COLUMNS);
+std::vector<uint64_t> growth; // cells where a tree can appear this step
+std::vector<uint64_t> lightning; // cells where a tree can ignite this step
+std::mt19937 bitsRng(std::time(0)); // of the bitplane, replicas and events engines
+ReplicaGrid replicas; // used by the replicas engine
+ClusterForest clusters; // used by the events engine
+Metrics metrics; // written to Metrics_1.csv/json on exit and on SIGUSR1
+Histogram & frameTime(metrics.histogram("frame"));
+Histogram & drawTime(metrics.histogram("draw"));
+Histogram & swapTime(metrics.histogram("swap"));
+Counter & frames(metrics.counter("frames"));
+Histogram * randomTime(0); // phases of the bitplane, replicas and events steps
+Histogram * propagationTime(0);
+Histogram * unpackTime(0);
+TimeSeries timeSeries;
+Recorder recorder;
+Replay replay; // --replay FILE plays a recording instead of simulating
+std::string resumeFile; // --resume FILE continues a checkpoint
+BandPool bands; // steps the rows on THREADS threads
+SimulationThread simulation; // after what the steps use
 // red, green, blue
 float colors[3][3] = {{1.0f, 1.0f, 1.0f}, // white
                       {0.0f, 1.0f, 0.0f}, // green
@@ -77,13 +132,13 @@ void write() {
     }
 }
 
-void draw_grid() {
+void draw_grid(const Grid & cells) {
     int temp;
     std::vector<float> tmpCoord;
     glColor3f(colors[TREE][0], colors[TREE][1], colors[TREE][2]);
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == TREE) { // the background is the same color as empty cells
+            if (cells[r][c] == TREE) { // the background is the same color as empty cells
                 tmpCoord = orth_coordinates(r, c);
                 glRectf(tmpCoord[0], tmpCoord[1],
                         tmpCoord[0] + scaleC, tmpCoord[1] + scaleR);
@@ -96,10 +151,10 @@ void draw_grid() {
         glColor3f(1.0f, 0.0f, 0.0f);
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] >= FIRE) {
+            if (cells[r][c] >= FIRE) {
                 tmpCoord = orth_coordinates(r, c);
                 if (FIRE_PERSISTANCE != 0) {
-                    redu = ((float)grid[r][c] - FIRE)/FIRE_PERSISTANCE;
+                    redu = ((float)cells[r][c] - FIRE)/FIRE_PERSISTANCE;
                     glColor3f(1.0f, 1.0f-redu, 1.0f-redu);
                 }
                 glRectf(tmpCoord[0], tmpCoord[1],
@@ -110,99 +165,234 @@ void draw_grid() {
 }
 
 void init_grid() {
-    grid = new int * [ROWS];
-    for (int i=0; i<ROWS; i++) {
-        grid[i] = new int [COLUMNS];
-        for (int j=0; j<COLUMNS; j++) {
-            grid[i][j] = EMPTY;
-        }
-    }
+    grid.init(ROWS, COLUMNS, EMPTY, BOUNDARY);
 }
 
 void init_neighbors(int type) {
     neighborsAmount = type;
-    switch (type) {
-        case VON_NEUMANN:
-            neighbors = VNNeighbors; break;
-        case MOORE:
-            neighbors = MNeighbors; break;
-    }
 }
 
-void new_tree(int row, int col) {
-    if (rand()%P == 0) {
-        grid[row][col] = NEW_TREE;
+void next_step_bitplane() {
+    {
+        ScopedTimer timer(randomTime);
+        bits.random_mask(growth, 1.0/P, bitsRng);
+        bits.random_mask(lightning, 1.0/F, bitsRng);
     }
+    {
+        ScopedTimer timer(propagationTime);
+        bits.ds_step(neighborsAmount == MOORE, growth, lightning);
+    }
+    // the int grid is still the one that is drawn
+    ScopedTimer timer(unpackTime);
+    for (int r=0; r<ROWS; r++)
+        bits.unpack_row(r, grid[r]);
+    // the bitplanes are counted 64 cells at a time, a fire lasts one step
+    observables.trees = bits.count(bits.tree);
+    observables.fires = bits.count(bits.fire);
+    observables.burnedArea += observables.fires;
 }
 
-void new_fire(int row, int col) {
-    // can randomly become a fire
-    if (rand()%F == 0) {
-        grid[row][col] = NEW_FIRE + FIRE_PERSISTANCE;
-        return;
+void next_step_replicas() {
+    {
+        ScopedTimer timer(randomTime);
+        replicas.random_mask(growth, 1.0/P, bitsRng);
+        replicas.random_mask(lightning, 1.0/F, bitsRng);
     }
-    // or put on fire if one is around
-    int newR, newC;
-    int temp;
-    for (int n=0; n<neighborsAmount; n++) {
-        newR = row + neighbors[n][0];
-        if (newR < 0 || newR >= ROWS) // check if out of grid
-            continue;
-        newC = col + neighbors[n][1];
-        if (newC < 0 || newC >= COLUMNS) // check if out of grid
-            continue;
-        temp = grid[newR][newC];
-        // if fire or old fire or (older fire but not just created)
-        if (temp == FIRE || temp == NEW_EMPTY ||
-            (temp > NEW_FIRE && temp != NEW_FIRE + FIRE_PERSISTANCE)) {
-            grid[row][col] = NEW_FIRE + FIRE_PERSISTANCE;
-            return;
+    {
+        ScopedTimer timer(propagationTime);
+        replicas.ds_step(neighborsAmount == MOORE, growth, lightning);
+    }
+    // only one of the replicas is drawn and counted
+    ScopedTimer timer(unpackTime);
+    observables.trees = observables.fires = 0;
+    for (int r=0; r<ROWS; r++) {
+        for (int c=0; c<COLUMNS; c++) {
+            if (replicas.get(replicas.fire, r, c, SHOWN_REPLICA))
+                grid[r][c] = FIRE;
+            else
+                grid[r][c] = replicas.get(replicas.tree, r, c, SHOWN_REPLICA) ? TREE : EMPTY;
+            observables.trees += grid[r][c] == TREE;
+            observables.fires += grid[r][c] == FIRE;
         }
     }
+    observables.burnedArea += observables.fires;
 }
 
-void next_step() {
-    //write();
-    // temporary states
+void next_step_events() {
+    ScopedTimer timer(propagationTime);
+    Observables changes;
+    if (neighborsAmount == MOORE)
+        clusters.step<Moore>(grid, P, F, bitsRng, changes);
+    else
+        clusters.step<VonNeumann>(grid, P, F, bitsRng, changes);
+    observables.apply(changes);
+}
+
+// the bitplanes from the int grid (resumed runs)
+void pack_bits() {
+    bits.clear();
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == EMPTY)
-                new_tree(r, c);
-            else if (grid[r][c] == TREE)
-                new_fire(r, c);
-            else if (grid[r][c] == FIRE)
-                grid[r][c] = NEW_EMPTY;
-            else if (grid[r][c] > NEW_FIRE)
-                grid[r][c]--;
+            if (grid[r][c] == TREE)
+                bits.set(bits.tree, r, c, true);
+            else if (grid[r][c] >= FIRE)
+                bits.set(bits.fire, r, c, true);
         }
     }
-    // temporary states to definitive state
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] < 6)
-                grid[r][c] %= 3;
+}
+
+// what a checkpoint must have been saved with to be resumed
+struct RunParameters {
+    int rows;
+    int cols;
+    int p;
+    int f;
+    int persistance;
+    int rng;
+    int engine;
+};
+
+RunParameters run_parameters() {
+    return {ROWS, COLUMNS, P, F, FIRE_PERSISTANCE, RNG, ENGINE};
+}
+
+void save_checkpoint() {
+    CheckpointWriter out;
+    out.put(run_parameters());
+    out.put(neighborsAmount);
+    std::ostringstream rngState;
+    randomEvents.save(rngState);
+    rngState << " " << bitsRng;
+    out.put_string(rngState.str());
+    out.put(observables);
+    out.put_cells(grid);
+    if (ENGINE == REPLICAS) // the other replicas aren't in the grid
+        for (std::size_t i=0; i<replicas.tree.size(); i++) {
+            out.put(replicas.tree[i]);
+            out.put(replicas.fire[i]);
+        }
+    out.save(CHECKPOINT_FILE);
+}
+
+bool load_checkpoint(const std::string & path) {
+    CheckpointReader in;
+    if (!in.load(path))
+        return false;
+    RunParameters saved, current(run_parameters());
+    in.get(saved);
+    if (in.good() && std::memcmp(&saved, &current, sizeof(saved)) != 0) {
+        std::cerr << path << " was saved with other ROWS, COLUMNS, P, F, "
+                  << "FIRE_PERSISTANCE, RNG or ENGINE" << std::endl;
+        return false;
+    }
+    std::string rngState;
+    in.get(neighborsAmount);
+    in.get_string(rngState);
+    in.get(observables);
+    in.get_cells(grid);
+    if (ENGINE == REPLICAS)
+        for (std::size_t i=0; i<replicas.tree.size(); i++) {
+            in.get(replicas.tree[i]);
+            in.get(replicas.fire[i]);
         }
+    std::istringstream state(rngState);
+    if (!in.good() || !randomEvents.load(state) || !(state >> bitsRng)) {
+        std::cerr << path << " is incomplete" << std::endl;
+        return false;
     }
+    pack_bits();
+    std::cout << "resumed at step " << randomEvents.step << " (seed "
+              << randomEvents.seed << ")" << std::endl;
+    return true;
+}
+
+void next_step() {
+    //write();
+    if (ENGINE == BITPLANE) {
+        randomEvents.step++;
+        next_step_bitplane();
+    }
+    else if (ENGINE == REPLICAS) {
+        randomEvents.step++;
+        next_step_replicas();
+    }
+    else if (ENGINE == EVENTS) {
+        randomEvents.step++;
+        next_step_events();
+    }
+    else if (neighborsAmount == MOORE)
+        ds_step_bands<Moore>(grid, rules, randomEvents, bands, &observables);
+    else
+        ds_step_bands<VonNeumann>(grid, rules, randomEvents, bands, &observables);
+    timeSeries.record(randomEvents.step, observables);
+    recorder.record(grid, randomEvents.step);
+#if CHECKPOINT_EVERY
+    if (randomEvents.step % CHECKPOINT_EVERY == 0)
+        save_checkpoint();
+#endif
 }
 
 void init() {
     glClearColor(colors[EMPTY][0], colors[EMPTY][1], colors[EMPTY][2], 0.0f);
+    randomEvents.set_seed((SEED != 0) ? SEED : std::time(0));
+    std::cout << "seed " << randomEvents.seed << std::endl;
+    bitsRng.seed(randomEvents.seed);
     init_grid();
     init_neighbors(MOORE);
+    if (RENDERER == TEXTURE)
+        renderer.init(ROWS, COLUMNS, colors, FIRE_PERSISTANCE);
+    if (ENGINE == REPLICAS)
+        replicas.resize(ROWS, COLUMNS);
+    if (ENGINE == EVENTS)
+        propagationTime = &metrics.histogram("events_step");
+    else if (ENGINE != INT_GRID) {
+        randomTime = &metrics.histogram("random_masks");
+        propagationTime = &metrics.histogram(ENGINE == BITPLANE ? "bitplane_step" : "replicas_step");
+        unpackTime = &metrics.histogram("unpack");
+    }
+    if (replay.is_open()) { // nothing to simulate
+        replay.show(grid);
+        return;
+    }
+    observables.count(grid);
+    if (!resumeFile.empty() && !load_checkpoint(resumeFile))
+        std::exit(1);
+    if (ENGINE == EVENTS) { // the clusters aren't saved
+        if (neighborsAmount == MOORE)
+            clusters.init<Moore>(grid);
+        else
+            clusters.init<VonNeumann>(grid);
+    }
+    if (TIME_SERIES && !resumeFile.empty())
+        timeSeries.resume(TIME_SERIES_FILE, (long long)ROWS * COLUMNS, randomEvents.step);
+    else if (TIME_SERIES)
+        timeSeries.open(TIME_SERIES_FILE, (long long)ROWS * COLUMNS);
+    if (RECORD_EVERY) {
+        recorder.open(RECORD_FILE, ROWS, COLUMNS, RECORD_EVERY, KEYFRAME_INTERVAL,
+                      randomEvents.seed);
+        recorder.record(grid, randomEvents.step);
+    }
+    bands.start(THREADS);
+    simulation.start(grid, next_step, STEPS_PER_FRAME, FPS, &metrics);
 }
 
 void display_callback() {
-    auto start(std::chrono::steady_clock::now());
-    
+    ScopedTimer frameTimer(&frameTime);
+    const Grid & shown(replay.is_open() ? grid : simulation.snapshot());
     glClear (GL_COLOR_BUFFER_BIT);
-
-    draw_grid();
-
-    glFlush();
-    glutSwapBuffers();
-
-    auto stop(std::chrono::steady_clock::now());
-    auto duration(std::chrono::duration_cast<std::chrono::milliseconds>(stop-start));
+    {
+        ScopedTimer drawTimer(&drawTime);
+        if (RENDERER == TEXTURE)
+            renderer.draw(shown);
+        else
+            draw_grid(shown);
+    }
+    {
+        ScopedTimer swapTimer(&swapTime);
+        glFlush();
+        glutSwapBuffers();
+    }
+    frames.add();
 }
 
 void reshape_callback(int width, int height) {
@@ -212,22 +402,63 @@ void reshape_callback(int width, int height) {
     glMatrixMode(GL_MODELVIEW);
 }
 
+void dump_metrics() {
+    metrics.dump("Metrics_1");
+}
+
+bool open_replay(const char * path) {
+    if (!replay.open(path))
+        return false;
+    if (replay.rows != ROWS || replay.cols != COLUMNS) {
+        std::cerr << "the recording is " << replay.rows << "x" << replay.cols
+                  << ", not " << ROWS << "x" << COLUMNS << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void show_replay() {
+    replay.show(grid);
+    std::string title("step " + std::to_string(replay.step()));
+    glutSetWindowTitle(title.c_str());
+}
+
+// space: pause, r: reverse, +/-: speed, ./,: one frame, 0-9: seek
+void keyboard_callback(unsigned char key, int, int) {
+    if (replay.is_open() && replay.key(key))
+        show_replay();
+}
+
 void timer_callback(int) {
-    next_step();
+    // the steps are done by the simulation thread
+    static int ticks(0);
+    if (replay.is_open() && replay.tick())
+        show_replay();
+    if (Metrics::dump_requested())
+        dump_metrics();
+    if (METRICS_TITLE && ++ticks % FPS == 0)
+        glutSetWindowTitle(metrics.overlay().c_str());
     glutPostRedisplay(); // run the display_callback function
-    glutTimerFunc(1000.0/FPS, timer_callback, 0);
+    glutTimerFunc(1000/FPS, timer_callback, 0);
 }
 
 int main(int argc, char **argv) {
     glutInit(&argc, argv); // initialize
+    if (argc > 2 && std::string(argv[1]) == "--replay" && !open_replay(argv[2]))
+        return 1;
+    if (argc > 2 && std::string(argv[1]) == "--resume")
+        resumeFile = argv[2];
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
     glutInitWindowPosition(15, 15); // optional
     glutInitWindowSize(COLUMNS*CELL_SIZE, ROWS*CELL_SIZE);
     glutCreateWindow("Forest Fire Simulation");
     glutDisplayFunc(display_callback);
     glutReshapeFunc(reshape_callback);
+    glutKeyboardFunc(keyboard_callback);
     glutTimerFunc(1000/FPS, timer_callback, 0);
     init();
+    Metrics::dump_on_signal(SIGUSR1);
+    std::atexit(dump_metrics);
     glutMainLoop();
     return 0;
 }
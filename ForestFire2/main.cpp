@@ -16,15 +16,27 @@ Forest fire simulation with only a line of fire at the bottom
 #include <chrono>
 #include <cmath>
 
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/texture_renderer.h"
+#include "../ForestFireCore/sim_thread.h"
+#include "../ForestFireCore/metrics.h"
+#include "../ForestFireCore/recorder.h"
+#include "../ForestFireCore/replay.h"
+#include "../ForestFireCore/time_series.h"
+#include "../ForestFireCore/band_pool.h"
 
 // the bottom line is permanently on fire
-#define EMPTY 0
-#define TREE 1
-#define FIRE 2
-#define NEW_EMPTY 3 // empty for the next round
-#define NEW_TREE 4 // tree for the next round
-#define NEW_FIRE 5 // fire for the next round
 #define P 100 // new tree probability 1/p
+#define RNG SKIP_SAMPLING // STD_RAND, SKIP_SAMPLING or COUNTER
+#define SEED 0 // 0 to seed from the time
+#define THREADS 1 // threads stepping bands of rows, 0 for all the cores
+#if THREADS != 1 && RNG != COUNTER
+#error "the threads need the random numbers of RNG COUNTER"
+#endif
+#define BOUNDARY FIXED // FIXED or PERIODIC
+#define RECTANGLES 0 // one rectangle per cell
+#define TEXTURE 1 // the whole grid in one texture
+#define RENDERER TEXTURE
 #define MOORE 8
 #define VON_NEUMANN 4
 
@@ -32,26 +44,37 @@ Forest fire simulation with only a line of fire at the bottom
 #define COLUMNS 400
 #define CELL_SIZE 2
 #define FPS 30
+#define STEPS_PER_FRAME 1 // steps drawn per frame, 0 to step as fast as possible
+#define METRICS_TITLE 0 // 1 to show the metrics in the window title
+#define RECORD_EVERY 0 // records every Nth step to RECORD_FILE, 0 not to record
+#define RECORD_FILE "Forest_fire_2.ffr"
+#define KEYFRAME_INTERVAL 100 // recorded frames between two full grids
+#define TIME_SERIES 0 // 1 to write the populations of each step to TIME_SERIES_FILE
+#define TIME_SERIES_FILE "Populations_2.csv"
 
 
 void timer_callback(int);
 void display_callback();
 void reshape_callback(int width, int height);
-void draw_grid();
+void draw_grid(const Grid & cells);
 
-int ** grid = nullptr;
+Grid grid;
+RandomEvents randomEvents(RNG, P, 0); // no lightning
+Rules rules = {0, ROWS-1}; // the bottom line never changes
+Observables observables; // updated by the steps
 int neighborsAmount;
-std::vector<std::vector<int>> neighbors;
+TextureRenderer renderer;
+Metrics metrics; // written to Metrics_2.csv/json on exit and on SIGUSR1
+Histogram & frameTime(metrics.histogram("frame"));
+Histogram & drawTime(metrics.histogram("draw"));
+Histogram & swapTime(metrics.histogram("swap"));
+Counter & frames(metrics.counter("frames"));
+TimeSeries timeSeries;
+Recorder recorder;
+Replay replay; // --replay FILE plays a recording instead of simulating
+BandPool bands; // steps the rows on THREADS threads
+SimulationThread simulation; // after what the steps use
 
-std::vector<std::vector<int>> VNNeighbors = {        {-1, 0},
-                                             {0, -1},       {0, 1},
-                                                     {1, 0}
-                                            };
-
-std::vector<std::vector<int>> MNeighbors = {{-1, -1}, {-1, 0}, {-1, 1},
-                                            {0, -1},            {0, 1},
-                                            {1, -1},   {1, 0},  {1, 1}
-                                           };
 // red, green, blue
 float colors[3][3] = {{1.0f, 1.0f, 1.0f}, // white
                       {0.0f, 1.0f, 0.0f}, // green
@@ -93,14 +116,14 @@ void write_time(int duration) {
     }
 }
 
-void draw_grid() {
+void draw_grid(const Grid & cells) {
     int temp;
     std::vector<float> tmpCoord;
     // this decomposition avoids changing color at each cell (faster)
     glColor3f(colors[TREE][0], colors[TREE][1], colors[TREE][2]);
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == TREE) { // the background is the same color as empty cells
+            if (cells[r][c] == TREE) { // the background is the same color as empty cells
                 tmpCoord = orth_coordinates(r, c);
                 glRectf(tmpCoord[0], tmpCoord[1],
                         tmpCoord[0] + scaleC, tmpCoord[1] + scaleR);
@@ -110,7 +133,7 @@ void draw_grid() {
     glColor3f(colors[FIRE][0], colors[FIRE][1], colors[FIRE][2]);
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == FIRE) { // the background is the same color as empty cells
+            if (cells[r][c] == FIRE) { // the background is the same color as empty cells
                 tmpCoord = orth_coordinates(r, c);
                 glRectf(tmpCoord[0], tmpCoord[1],
                         tmpCoord[0] + scaleC, tmpCoord[1] + scaleR);
@@ -120,90 +143,66 @@ void draw_grid() {
 }
 
 void init_grid() {
-    grid = new int * [ROWS];
-    for (int i=0; i<ROWS; i++) {
-        grid[i] = new int [COLUMNS];
-        for (int j=0; j<COLUMNS; j++) {
-            //grid[i][j] = (rand()%100 < treeOdds) ? TREE : EMPTY;
-            if (i == ROWS-1)
-                grid[i][j] = FIRE;
-            else
-                grid[i][j] = EMPTY;
-        }
-    }
+    grid.init(ROWS, COLUMNS, EMPTY, BOUNDARY);
+    for (int j=0; j<COLUMNS; j++)
+        grid[ROWS-1][j] = FIRE;
+    grid.sync();
 }
 
 void init_neighbors(int type) {
     neighborsAmount = type;
-    switch (type) {
-        case VON_NEUMANN:
-            neighbors = VNNeighbors; break;
-        case MOORE:
-            neighbors = MNeighbors; break;
-    }
-}
-
-void new_tree(int row, int col) {
-    if (rand()%P == 0) {
-        grid[row][col] = NEW_TREE;
-    }
-}
-
-void new_fire(int row, int col) {
-    int newR, newC;
-    for (int n=0; n<neighborsAmount; n++) {
-        newR = row + neighbors[n][0];
-        if (newR < 0 || newR >= ROWS) // check if out of grid
-            continue;
-        newC = col + neighbors[n][1];
-        if (newC < 0 || newC >= COLUMNS) // check if out of grid
-            continue;
-        if (grid[newR][newC] == FIRE || grid[newR][newC] == NEW_EMPTY) {
-            grid[row][col] = NEW_FIRE;
-            return;
-        }
-    }
 }
 
 void next_step() {
-    // temporary states
-    for (int r=0; r<ROWS-1; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            switch (grid[r][c]) {
-                case EMPTY:
-                    new_tree(r, c); break;
-                case TREE:
-                    new_fire(r, c); break;
-                case FIRE:
-                    grid[r][c] = NEW_EMPTY; break;
-            }
-        }
-    }
-    // temporary states to definitive state
-    for (int r=0; r<ROWS-1; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            grid[r][c] %= 3;
-        }
-    }
+    if (neighborsAmount == MOORE)
+        ds_step_bands<Moore>(grid, rules, randomEvents, bands, &observables);
+    else
+        ds_step_bands<VonNeumann>(grid, rules, randomEvents, bands, &observables);
+    timeSeries.record(randomEvents.step, observables);
+    recorder.record(grid, randomEvents.step);
 }
 
 void init() {
     glClearColor(colors[EMPTY][0], colors[EMPTY][1], colors[EMPTY][2], 0.0f);
+    randomEvents.set_seed((SEED != 0) ? SEED : std::time(0));
+    std::cout << "seed " << randomEvents.seed << std::endl;
     init_grid();
     init_neighbors(MOORE);
+    if (RENDERER == TEXTURE)
+        renderer.init(ROWS, COLUMNS, colors, 0);
+    if (replay.is_open()) { // nothing to simulate
+        replay.show(grid);
+        return;
+    }
+    observables.count(grid);
+    if (TIME_SERIES)
+        timeSeries.open(TIME_SERIES_FILE, (long long)ROWS * COLUMNS);
+    if (RECORD_EVERY) {
+        recorder.open(RECORD_FILE, ROWS, COLUMNS, RECORD_EVERY, KEYFRAME_INTERVAL,
+                      randomEvents.seed);
+        recorder.record(grid, 0);
+    }
+    bands.start(THREADS);
+    simulation.start(grid, next_step, STEPS_PER_FRAME, FPS, &metrics);
 }
 
 void display_callback() {
-    auto start(std::chrono::steady_clock::now());
-    
-    
+    ScopedTimer frameTimer(&frameTime);
+    const Grid & shown(replay.is_open() ? grid : simulation.snapshot());
     glClear (GL_COLOR_BUFFER_BIT);
-    draw_grid();
-
-    glutSwapBuffers();
-
-    auto stop(std::chrono::steady_clock::now());
-    auto duration(std::chrono::duration_cast<std::chrono::milliseconds>(stop-start));
+    {
+        ScopedTimer drawTimer(&drawTime);
+        if (RENDERER == TEXTURE)
+            renderer.draw(shown);
+        else
+            draw_grid(shown);
+    }
+    {
+        ScopedTimer swapTimer(&swapTime);
+        glFlush();
+        glutSwapBuffers();
+    }
+    frames.add();
 }
 
 void reshape_callback(int width, int height) {
@@ -213,23 +212,62 @@ void reshape_callback(int width, int height) {
     glMatrixMode(GL_MODELVIEW);
 }
 
+void dump_metrics() {
+    metrics.dump("Metrics_2");
+}
+
+bool open_replay(const char * path) {
+    if (!replay.open(path))
+        return false;
+    if (replay.rows != ROWS || replay.cols != COLUMNS) {
+        std::cerr << "the recording is " << replay.rows << "x" << replay.cols
+                  << ", not " << ROWS << "x" << COLUMNS << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void show_replay() {
+    replay.show(grid);
+    std::string title("step " + std::to_string(replay.step()));
+    glutSetWindowTitle(title.c_str());
+}
+
+// space: pause, r: reverse, +/-: speed, ./,: one frame, 0-9: seek
+void keyboard_callback(unsigned char key, int, int) {
+    if (replay.is_open() && replay.key(key))
+        show_replay();
+}
+
 void timer_callback(int) {
-    next_step();
+    // the steps are done by the simulation thread
+    static int ticks(0);
+    if (replay.is_open() && replay.tick())
+        show_replay();
+    if (Metrics::dump_requested())
+        dump_metrics();
+    if (METRICS_TITLE && ++ticks % FPS == 0)
+        glutSetWindowTitle(metrics.overlay().c_str());
     glutPostRedisplay(); // run the display_callback function
-    glutTimerFunc(1000.0/FPS, timer_callback, 0);
+    glutTimerFunc(1000/FPS, timer_callback, 0);
 }
 
 int main(int argc, char **argv)
 {
     glutInit(&argc, argv); // initialize
+    if (argc > 2 && std::string(argv[1]) == "--replay" && !open_replay(argv[2]))
+        return 1;
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
     glutInitWindowPosition(15, 15); // optional
     glutInitWindowSize(COLUMNS*CELL_SIZE, ROWS*CELL_SIZE);
     glutCreateWindow("Forest Fire simulation");
     glutDisplayFunc(display_callback);
     glutReshapeFunc(reshape_callback);
+    glutKeyboardFunc(keyboard_callback);
     glutTimerFunc(1000/FPS, timer_callback, 0);
     init();
+    Metrics::dump_on_signal(SIGUSR1);
+    std::atexit(dump_metrics);
     glutMainLoop();
     return 0;
 }
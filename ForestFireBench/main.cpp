@@ -0,0 +1,347 @@
+/*
+
+Benchmarks of the steppers of the other scripts, without a window
+
+Each stepper runs on square grids from 100x100 to 8000x8000, each size in
+its own process so that the peak memory is its own. The results are
+printed and written to Bench.csv and Bench.json to compare two builds.
+
+The ds_* benches are whole steps of the GUIs (the bitplane one unpacks
+the cells and counts them like ForestFire does). The percolation_* ones
+only time the burn steps of BitGrid and ReplicaGrid: the sweeps of the
+simulation, with their engines, time themselves.
+
+Usage: Forest_fire_bench [largest size]
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../ForestFireCore/bitgrid.h"
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/band_pool.h"
+#include "../ForestFireCore/replica_grid.h"
+#include "../ForestFireCore/cluster_forest.h"
+
+#define P 100 // new tree probability 1/p
+#define F 1000 // fire probability 1/f
+#define RNG SKIP_SAMPLING // STD_RAND, SKIP_SAMPLING or COUNTER
+#define SEED 1 // the same grids for every build
+#define TREE_DENSITY 0.4 // initial trees of the Drossel-Schwabl grids
+#define FIRE_DENSITY 0.01 // initial fires of the Drossel-Schwabl grids
+#define PERCOLATION_DENSITY 0.6 // close to the threshold, long fires
+#define WARMUP_STEPS 2
+#define MIN_STEPS 5
+#define MIN_SECONDS 1.0 // each size is stepped at least this long
+
+std::vector<int> sizes = {100, 250, 500, 1000, 2000, 4000, 8000};
+
+// init prepares a grid of the given size, step returns false when the grid
+// must be prepared again (a burnt out percolation), grids stepped at once
+struct Bench {
+    std::string name;
+    std::function<void(int)> init;
+    std::function<bool()> step;
+    int grids;
+};
+
+struct Result {
+    int size;
+    long long steps;
+    double seconds;
+    double p50; // step latencies in microseconds
+    double p90;
+    double p99;
+    double max;
+    long peakRss; // kB
+    int grids;
+};
+
+Grid grid;
+RandomEvents randomEvents(RNG, P, F);
+RandomEvents counterEvents(COUNTER, P, F); // of the threaded steps
+BandPool bands; // all the cores
+Rules rules = {0, 0};
+BitGrid bits;
+ReplicaGrid replicas;
+ClusterForest clusters;
+Observables observables;
+std::vector<uint64_t> growth;
+std::vector<uint64_t> lightning;
+std::mt19937 rng(SEED);
+
+void init_ds_grid(int size) {
+    grid.init(size, size);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int r=0; r<size; r++) {
+        for (int c=0; c<size; c++) {
+            double u(uniform(rng));
+            if (u < FIRE_DENSITY)
+                grid[r][c] = FIRE;
+            else if (u < FIRE_DENSITY + TREE_DENSITY)
+                grid[r][c] = TREE;
+        }
+    }
+    grid.sync();
+    rules.steppedRows = size;
+    randomEvents.set_seed(SEED);
+    counterEvents.set_seed(SEED);
+}
+
+void init_bits(int size, double density) {
+    bits.resize(size, size);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int r=0; r<size; r++)
+        for (int c=0; c<size; c++)
+            bits.set(bits.tree, r, c, uniform(rng) < density);
+}
+
+void init_ds_bits(int size) {
+    init_bits(size, TREE_DENSITY);
+    grid.init(size, size); // where the cells are unpacked
+}
+
+void init_replicas(int size, double treeDensity, double fireDensity) {
+    replicas.resize(size, size);
+    replicas.random_mask(replicas.tree, treeDensity, rng);
+    replicas.random_mask(replicas.fire, fireDensity, rng);
+    for (std::size_t i=0; i<replicas.tree.size(); i++)
+        replicas.tree[i] &= ~replicas.fire[i];
+}
+
+void init_percolation(int size) {
+    init_bits(size, PERCOLATION_DENSITY);
+    // fire on the middle, like the simulation
+    bits.set(bits.tree, size/2, size/2, false);
+    bits.set(bits.fire, size/2, size/2, true);
+}
+
+template <class Stencil>
+Bench ds_bench(const std::string & name) {
+    return {name, init_ds_grid, []() {
+        ds_step<Stencil>(grid, rules, randomEvents);
+        return true;
+    }, 1};
+}
+
+// threads: 1 for the same step on one thread, 0 for all the cores
+template <class Stencil>
+Bench ds_bands_bench(const std::string & name, int threads) {
+    return {name, [threads](int size) {
+        init_ds_grid(size);
+        bands.start(threads);
+    }, []() {
+        ds_step_bands<Stencil>(grid, rules, counterEvents, bands);
+        return true;
+    }, 1};
+}
+
+// the step of next_step_bitplane, with the unpack and the counts
+Bench ds_bits_bench(const std::string & name, bool moore) {
+    return {name, init_ds_bits, [moore]() {
+        bits.random_mask(growth, 1.0/P, rng);
+        bits.random_mask(lightning, 1.0/F, rng);
+        bits.ds_step(moore, growth, lightning);
+        for (int r=0; r<bits.rows; r++)
+            bits.unpack_row(r, grid[r]);
+        observables.trees = bits.count(bits.tree);
+        observables.fires = bits.count(bits.fire);
+        return true;
+    }, 1};
+}
+
+// the 64 grids, without unpacking the drawn one
+Bench ds_replicas_bench(const std::string & name, bool moore) {
+    return {name, [](int size) {
+        init_replicas(size, TREE_DENSITY, FIRE_DENSITY);
+    }, [moore]() {
+        replicas.random_mask(growth, 1.0/P, rng);
+        replicas.random_mask(lightning, 1.0/F, rng);
+        replicas.ds_step(moore, growth, lightning);
+        return true;
+    }, REPLICAS_AMOUNT};
+}
+
+// a step is as many events as the cells draw in a step of the others
+template <class Stencil>
+Bench ds_events_bench(const std::string & name) {
+    return {name, [](int size) {
+        init_ds_grid(size);
+        clusters.init<Stencil>(grid);
+    }, []() {
+        Observables changes;
+        clusters.step<Stencil>(grid, P, F, rng, changes);
+        observables.apply(changes);
+        return true;
+    }, 1};
+}
+
+Bench percolation_bench(const std::string & name, bool moore) {
+    return {name, init_percolation, [moore]() {
+        return bits.burn_step(moore);
+    }, 1};
+}
+
+Bench percolation_replicas_bench(const std::string & name, bool moore) {
+    return {name, [](int size) {
+        init_replicas(size, PERCOLATION_DENSITY, 0.0);
+        replicas.row(replicas.tree, size/2)[size/2] = 0;
+        replicas.row(replicas.fire, size/2)[size/2] = ~0ULL;
+    }, [moore]() {
+        return replicas.burn_step(moore) != 0;
+    }, REPLICAS_AMOUNT};
+}
+
+std::vector<Bench> benches() {
+    return {ds_bench<VonNeumann>("ds_von_neumann"),
+            ds_bench<Moore>("ds_moore"),
+            ds_bench<Hexagonal>("ds_hexagonal"),
+            ds_bench<TriangularSide>("ds_triangular_side"),
+            ds_bench<TriangularAll>("ds_triangular_all"),
+            ds_bands_bench<Moore>("ds_moore_counter", 1),
+            ds_bands_bench<Moore>("ds_moore_threads", 0),
+            ds_bits_bench("ds_bitplane_von_neumann", false),
+            ds_bits_bench("ds_bitplane_moore", true),
+            ds_replicas_bench("ds_replicas_moore", true),
+            ds_events_bench<Moore>("ds_events_moore"),
+            percolation_bench("percolation_bitgrid_von_neumann", false),
+            percolation_bench("percolation_bitgrid_moore", true),
+            percolation_replicas_bench("percolation_replicas_moore", true)};
+}
+
+double percentile(const std::vector<double> & sorted, double q) {
+    std::size_t i((std::size_t)(q * (sorted.size() - 1) + 0.5));
+    return sorted[i];
+}
+
+Result run(Bench & bench, int size) {
+    typedef std::chrono::steady_clock Clock;
+    bench.init(size);
+    for (int i=0; i<WARMUP_STEPS; i++)
+        if (!bench.step())
+            bench.init(size);
+    std::vector<double> latencies;
+    double total(0.0);
+    while ((int)latencies.size() < MIN_STEPS || total < MIN_SECONDS) {
+        auto start(Clock::now());
+        bool alive(bench.step());
+        std::chrono::duration<double> duration(Clock::now() - start);
+        latencies.push_back(duration.count() * 1e6);
+        total += duration.count();
+        if (!alive) // not timed
+            bench.init(size);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return {size, (long long)latencies.size(), total,
+            percentile(latencies, 0.5), percentile(latencies, 0.9),
+            percentile(latencies, 0.99), latencies.back(), usage.ru_maxrss,
+            bench.grids};
+}
+
+// runs in a child process so that the peak memory only counts this size
+bool run_isolated(Bench & bench, int size, Result & result) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    pid_t pid(fork());
+    if (pid == 0) {
+        close(fds[0]);
+        Result res(run(bench, size));
+        bool written(write(fds[1], &res, sizeof(res)) == sizeof(res));
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok(pid > 0 && read(fds[0], &result, sizeof(result)) == sizeof(result));
+    close(fds[0]);
+    if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return ok;
+}
+
+double cell_updates(const Result & res) {
+    return (double)res.size * res.size * res.grids * res.steps / res.seconds;
+}
+
+void write_results(const std::vector<std::string> & names,
+                   const std::vector<Result> & results) {
+    std::ofstream csv("Bench.csv");
+    std::ofstream json("Bench.json");
+    csv << std::setprecision(10);
+    json << std::setprecision(10);
+    csv << "benchmark,rows,cols,steps,seconds,cell_updates_per_s,"
+        << "p50_us,p90_us,p99_us,max_us,peak_rss_kb,grids" << std::endl;
+    json << "{\n  \"compiler\": \"" << __VERSION__ << "\",\n";
+#ifdef __AVX2__
+    json << "  \"avx2\": true,\n";
+#else
+    json << "  \"avx2\": false,\n";
+#endif
+    json << "  \"results\": [";
+    for (std::size_t i=0; i<results.size(); i++) {
+        const Result & res(results[i]);
+        csv << names[i] << "," << res.size << "," << res.size << ","
+            << res.steps << "," << res.seconds << "," << cell_updates(res) << ","
+            << res.p50 << "," << res.p90 << "," << res.p99 << ","
+            << res.max << "," << res.peakRss << "," << res.grids << std::endl;
+        json << (i ? ",\n" : "\n") << "    {\"benchmark\": \"" << names[i]
+             << "\", \"rows\": " << res.size << ", \"cols\": " << res.size
+             << ", \"steps\": " << res.steps << ", \"seconds\": " << res.seconds
+             << ", \"cell_updates_per_s\": " << cell_updates(res)
+             << ", \"p50_us\": " << res.p50 << ", \"p90_us\": " << res.p90
+             << ", \"p99_us\": " << res.p99 << ", \"max_us\": " << res.max
+             << ", \"peak_rss_kb\": " << res.peakRss
+             << ", \"grids\": " << res.grids << "}";
+    }
+    json << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int largest(argc > 1 ? std::atoi(argv[1]) : sizes.back());
+    std::vector<Bench> all(benches());
+    std::vector<std::string> names;
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right
+              << std::setw(6) << "size" << std::setw(8) << "steps"
+              << std::setw(12) << "Mcells/s" << std::setw(11) << "p50 us"
+              << std::setw(11) << "p99 us" << std::setw(11) << "rss kB"
+              << std::endl;
+    for (Bench & bench : all) {
+        for (int size : sizes) {
+            if (size > largest)
+                continue;
+            Result res;
+            if (!run_isolated(bench, size, res)) {
+                std::cerr << bench.name << " " << size << " failed" << std::endl;
+                continue;
+            }
+            names.push_back(bench.name);
+            results.push_back(res);
+            std::cout << std::left << std::setw(32) << bench.name << std::right
+                      << std::setw(6) << size << std::setw(8) << res.steps
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(12) << cell_updates(res) / 1e6
+                      << std::setw(11) << res.p50 << std::setw(11) << res.p99
+                      << std::setw(11) << res.peakRss << std::endl;
+        }
+    }
+    write_results(names, results);
+    return 0;
+}
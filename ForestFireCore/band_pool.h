@@ -0,0 +1,130 @@
+/*
+
+Persistent pool of threads that step bands of rows of the grid: the
+threads are started once and wait for the next step, the calling thread
+steps the first band and waits at the barrier for the others.
+
+The bands need random numbers that don't depend on the order of the cells
+(RNG COUNTER): the number of a cell is a function of (seed, step, cell),
+so the result is the same for any amount of threads.
+
+*/
+
+#ifndef FORESTFIRE_BAND_POOL_H
+#define FORESTFIRE_BAND_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lattice.h"
+
+class BandPool {
+  public:
+    BandPool() : generation(0), pending(0), stopping(false), task(0) {}
+    ~BandPool() { stop(); }
+
+    // threads: 0 for all the cores, the calling thread counts as one
+    void start(int threads) {
+        stop();
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        stopping = false;
+        for (int b=1; b<threads; b++)
+            workers.push_back(std::thread(&BandPool::work, this, b));
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread & t : workers)
+            t.join();
+        workers.clear();
+    }
+
+    int bands() const { return workers.size() + 1; }
+
+    // calls f(band) on every band at once, returns when all are done
+    void run(const std::function<void(int)> & f) {
+        if (workers.empty()) {
+            f(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            pending = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        f(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+    }
+
+  private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned long long generation; // of the last task
+    int pending; // bands not done yet
+    bool stopping;
+    const std::function<void(int)> * task;
+
+    void work(int band) {
+        unsigned long long seen(0);
+        while (true) {
+            const std::function<void(int)> * f;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                f = task;
+            }
+            (*f)(band);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+};
+
+// ds_step with the rows split into one band per thread of the pool
+template <class Stencil>
+void ds_step_bands(Grid & grid, const Rules & rules, RandomEvents & random,
+                   BandPool & pool, Observables * observables=0) {
+    random.step++;
+    grid.fill_halo();
+    int bands(pool.bands());
+    std::vector<Observables> changes(bands);
+    pool.run([&](int b) {
+        int first((long long)rules.steppedRows * b / bands);
+        int last((long long)rules.steppedRows * (b + 1) / bands);
+        ds_rows<Stencil>(grid, rules, random, first, last, changes[b]);
+    });
+    for (int r=rules.steppedRows; r<grid.rows; r++)
+        std::memcpy(grid.next(r), grid[r], grid.cols);
+    grid.swap();
+    Observables sum;
+    for (const Observables & c : changes) {
+        sum.grown += c.grown;
+        sum.struck += c.struck;
+        sum.lit += c.lit;
+        sum.burntOut += c.burntOut;
+        sum.perimeter += c.perimeter;
+    }
+    if (observables)
+        observables->apply(sum);
+}
+
+#endif
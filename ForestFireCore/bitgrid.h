@@ -0,0 +1,229 @@
+/*
+
+Bit-packed grid for the square lattices: one bit per cell per state
+
+*/
+
+#ifndef FORESTFIRE_BITGRID_H
+#define FORESTFIRE_BITGRID_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <random>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// bit c%64 of the word c/64 is the column c
+// every row is padded by a zero word on both sides and the grid by a zero
+// row above and below, so the shifts never need a bounds check
+class BitGrid {
+  public:
+    int rows;
+    int cols;
+    int words; // useful words per row
+    int stride; // words per row including the padding
+    std::vector<uint64_t> tree;
+    std::vector<uint64_t> fire;
+    std::vector<uint64_t> ashes; // every cell that has burnt (percolation)
+
+    BitGrid() : rows(0), cols(0), words(0), stride(2) {}
+    BitGrid(int r, int c) { resize(r, c); }
+
+    void resize(int r, int c) {
+        rows = r;
+        cols = c;
+        words = (c + 63) / 64;
+        stride = words + 2;
+        std::size_t size((std::size_t)(rows + 2) * stride);
+        tree.assign(size, 0);
+        fire.assign(size, 0);
+        ashes.assign(size, 0);
+        nextFire.assign(size, 0);
+        around.assign(stride, 0);
+        // the columns that exist and the ones that can burn in percolation
+        lastMask = (c % 64) ? (~0ULL >> (64 - c % 64)) : ~0ULL;
+        interior.assign(stride, 0);
+        for (int col=1; col<cols-1; col++)
+            interior[1 + col/64] |= 1ULL << (col%64);
+    }
+
+    void clear() {
+        std::fill(tree.begin(), tree.end(), 0);
+        std::fill(fire.begin(), fire.end(), 0);
+        std::fill(ashes.begin(), ashes.end(), 0);
+    }
+
+    uint64_t * row(std::vector<uint64_t> & plane, int r) {
+        return &plane[(std::size_t)(r + 1) * stride + 1];
+    }
+
+    bool get(const std::vector<uint64_t> & plane, int r, int c) const {
+        return (plane[(std::size_t)(r + 1) * stride + 1 + c/64] >> (c%64)) & 1;
+    }
+
+    void set(std::vector<uint64_t> & plane, int r, int c, bool value) {
+        uint64_t & w(plane[(std::size_t)(r + 1) * stride + 1 + c/64]);
+        uint64_t bit(1ULL << (c%64));
+        w = value ? (w | bit) : (w & ~bit);
+    }
+
+    long long count(const std::vector<uint64_t> & plane) const {
+        long long res(0);
+        for (uint64_t w : plane)
+            res += __builtin_popcountll(w);
+        return res;
+    }
+
+    // the row r as one byte per cell, tree bit | fire bit << 1 (the EMPTY,
+    // TREE and FIRE of lattice.h), a word at a time and empty words at once
+    void unpack_row(int r, uint8_t * out) const {
+        const uint64_t * t(&tree[(std::size_t)(r + 1) * stride + 1]);
+        const uint64_t * f(&fire[(std::size_t)(r + 1) * stride + 1]);
+        for (int w=0; w<words; w++) {
+            int first(w * 64);
+            int n(std::min(64, cols - first));
+            uint64_t tw(t[w]), fw(f[w]);
+            if (!(tw | fw)) {
+                std::memset(out + first, 0, n);
+                continue;
+            }
+            for (int b=0; b<n; b++)
+                out[first + b] = ((tw >> b) & 1) | (((fw >> b) & 1) << 1);
+        }
+    }
+
+    // same as count but without the border cells (percolation stats)
+    long long count_interior(std::vector<uint64_t> & plane) {
+        long long res(0);
+        for (int r=1; r<rows-1; r++) {
+            const uint64_t * p(row(plane, r));
+            for (int w=0; w<words; w++)
+                res += __builtin_popcountll(p[w] & interior[w+1]);
+        }
+        return res;
+    }
+
+    // bits of the row r that have a fire in their neighborhood
+    void fire_around(int r, bool moore, uint64_t * out) {
+        const uint64_t * up(row(fire, r-1));
+        const uint64_t * mid(row(fire, r));
+        const uint64_t * down(row(fire, r+1));
+        int w(0);
+#ifdef __AVX2__
+        for (; w + 4 <= words; w += 4) {
+            __m256i u(load(up + w)), m(load(mid + w)), d(load(down + w));
+            __m256i res;
+            if (moore) {
+                __m256i v(_mm256_or_si256(_mm256_or_si256(u, m), d));
+                __m256i vl(_mm256_or_si256(_mm256_or_si256(load(up + w - 1), load(mid + w - 1)),
+                                           load(down + w - 1)));
+                __m256i vr(_mm256_or_si256(_mm256_or_si256(load(up + w + 1), load(mid + w + 1)),
+                                           load(down + w + 1)));
+                res = _mm256_or_si256(v, _mm256_or_si256(shift_left(v, vl),
+                                                         shift_right(v, vr)));
+            }
+            else {
+                res = _mm256_or_si256(_mm256_or_si256(u, d),
+                                      _mm256_or_si256(shift_left(m, load(mid + w - 1)),
+                                                      shift_right(m, load(mid + w + 1))));
+            }
+            _mm256_storeu_si256((__m256i *)(out + w), res);
+        }
+#endif
+        for (; w<words; w++) {
+            if (moore) {
+                uint64_t v(up[w] | mid[w] | down[w]);
+                uint64_t vl(up[w-1] | mid[w-1] | down[w-1]);
+                uint64_t vr(up[w+1] | mid[w+1] | down[w+1]);
+                out[w] = v | (v << 1) | (vl >> 63) | (v >> 1) | (vr << 63);
+            }
+            else {
+                out[w] = up[w] | down[w] | (mid[w] << 1) | (mid[w-1] >> 63) |
+                         (mid[w] >> 1) | (mid[w+1] << 63);
+            }
+        }
+    }
+
+    // percolation rules: the trees next to a fire burn, the fires become
+    // ashes and the border never burns
+    bool burn_step(bool moore) {
+        bool isAnyOnFire(false);
+        for (int r=1; r<rows-1; r++) {
+            uint64_t * t(row(tree, r));
+            uint64_t * nf(row(nextFire, r));
+            fire_around(r, moore, &around[1]);
+            for (int w=0; w<words; w++) {
+                nf[w] = t[w] & around[w+1] & interior[w+1];
+                t[w] &= ~nf[w];
+                isAnyOnFire |= nf[w] != 0;
+            }
+        }
+        for (int r=0; r<rows; r++) {
+            uint64_t * f(row(fire, r));
+            uint64_t * a(row(ashes, r));
+            for (int w=0; w<words; w++)
+                a[w] |= f[w];
+        }
+        fire.swap(nextFire);
+        return isAnyOnFire;
+    }
+
+    // Drossel-Schwabl rules: the fires become empty, a tree burns if struck
+    // by lightning or next to a fire and an empty cell grows if in growth
+    void ds_step(bool moore, std::vector<uint64_t> & growth,
+                 std::vector<uint64_t> & lightning) {
+        for (int r=0; r<rows; r++) {
+            uint64_t * t(row(tree, r));
+            const uint64_t * f(row(fire, r));
+            const uint64_t * g(row(growth, r));
+            const uint64_t * l(row(lightning, r));
+            uint64_t * nf(row(nextFire, r));
+            fire_around(r, moore, &around[1]);
+            for (int w=0; w<words; w++) {
+                uint64_t empty(~(t[w] | f[w]));
+                nf[w] = t[w] & (around[w+1] | l[w]);
+                t[w] = (t[w] & ~nf[w]) | (empty & g[w]);
+            }
+            t[words-1] &= lastMask;
+        }
+        fire.swap(nextFire);
+    }
+
+    // sets each cell with probability p by drawing the gaps between the
+    // set cells from a geometric distribution
+    template <class URNG>
+    void random_mask(std::vector<uint64_t> & mask, double p, URNG & gen) {
+        mask.assign(tree.size(), 0);
+        if (p <= 0.0)
+            return;
+        std::geometric_distribution<long long> gap(p);
+        long long total((long long)rows * cols);
+        for (long long i=gap(gen); i<total; i += 1 + gap(gen))
+            set(mask, i / cols, i % cols, true);
+    }
+
+  private:
+    std::vector<uint64_t> nextFire;
+    std::vector<uint64_t> around; // padded like a row
+    std::vector<uint64_t> interior; // padded like a row
+    uint64_t lastMask;
+
+#ifdef __AVX2__
+    static __m256i load(const uint64_t * p) {
+        return _mm256_loadu_si256((const __m256i *)p);
+    }
+    // value of the column on the left / right of each bit
+    static __m256i shift_left(__m256i v, __m256i previous) {
+        return _mm256_or_si256(_mm256_slli_epi64(v, 1), _mm256_srli_epi64(previous, 63));
+    }
+    static __m256i shift_right(__m256i v, __m256i next) {
+        return _mm256_or_si256(_mm256_srli_epi64(v, 1), _mm256_slli_epi64(next, 63));
+    }
+#endif
+};
+
+#endif
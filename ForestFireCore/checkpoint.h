@@ -0,0 +1,153 @@
+/*
+
+Binary checkpoints: the fields are appended to a buffer in memory, then
+written to path.tmp, synced and renamed over path (and the directory
+synced), so a crash while saving leaves the previous checkpoint intact
+
+File: magic, version, then the fields in the order they were put (native
+byte order, the files are read back on the same machine)
+
+*/
+
+#ifndef FORESTFIRE_CHECKPOINT_H
+#define FORESTFIRE_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lattice.h"
+
+#define CHECKPOINT_MAGIC 0x4B434646 // "FFCK"
+#define CHECKPOINT_VERSION 2
+
+class CheckpointWriter {
+  public:
+    CheckpointWriter() {
+        put((uint32_t)CHECKPOINT_MAGIC);
+        put((uint32_t)CHECKPOINT_VERSION);
+    }
+
+    // plain values (ints, doubles, structs of them)
+    template <class T>
+    void put(const T & value) {
+        const uint8_t * p((const uint8_t *)&value);
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+
+    void put_string(const std::string & s) {
+        put((uint64_t)s.size());
+        data.insert(data.end(), s.begin(), s.end());
+    }
+
+    // the current cells, without the halo
+    void put_cells(const Grid & grid) {
+        for (int r=0; r<grid.rows; r++)
+            data.insert(data.end(), grid[r], grid[r] + grid.cols);
+    }
+
+    bool save(const std::string & path) const {
+        std::string tmp(path + ".tmp");
+        std::FILE * file(std::fopen(tmp.c_str(), "wb"));
+        bool ok(file != 0);
+        if (ok) {
+            ok = std::fwrite(&data[0], 1, data.size(), file) == data.size();
+            ok = std::fflush(file) == 0 && ok;
+            ok = fsync(fileno(file)) == 0 && ok;
+            ok = std::fclose(file) == 0 && ok;
+        }
+        if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::cerr << "can't write the checkpoint " << path << std::endl;
+            std::remove(tmp.c_str());
+            return false;
+        }
+        // the rename is only durable once the directory is synced too
+        if (!sync_directory(path)) {
+            std::cerr << "can't sync the directory of " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    std::vector<uint8_t> data;
+
+    static bool sync_directory(const std::string & path) {
+        std::string::size_type slash(path.rfind('/'));
+        std::string dir(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+        int fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY));
+        if (fd < 0)
+            return false;
+        bool ok(fsync(fd) == 0);
+        return close(fd) == 0 && ok;
+    }
+};
+
+class CheckpointReader {
+  public:
+    CheckpointReader() : position(0), ok(false) {}
+
+    bool load(const std::string & path) {
+        std::ifstream file(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+        position = 0;
+        ok = true;
+        uint32_t magic(0), version(0);
+        get(magic);
+        get(version);
+        ok = ok && magic == CHECKPOINT_MAGIC && version == CHECKPOINT_VERSION;
+        if (!ok)
+            std::cerr << path << " is not a checkpoint" << std::endl;
+        return ok;
+    }
+
+    // false once anything was missing, the values are then left unchanged
+    bool good() const { return ok; }
+
+    template <class T>
+    void get(T & value) {
+        if (!take(sizeof(T)))
+            return;
+        std::memcpy(&value, &data[position - sizeof(T)], sizeof(T));
+    }
+
+    void get_string(std::string & s) {
+        uint64_t size(0);
+        get(size);
+        if (!take(size))
+            return;
+        s.assign(&data[position - size], &data[position - size] + size);
+    }
+
+    void get_cells(Grid & grid) {
+        for (int r=0; r<grid.rows; r++) {
+            if (!take(grid.cols))
+                return;
+            std::memcpy(grid[r], &data[position - grid.cols], grid.cols);
+        }
+        grid.sync();
+    }
+
+  private:
+    std::vector<char> data;
+    std::size_t position;
+    bool ok;
+
+    bool take(std::size_t size) {
+        ok = ok && size <= data.size() - position;
+        if (ok)
+            position += size;
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+
+Event-driven Drossel-Schwabl in the limit where a fire burns out before
+anything grows (f << p): instead of stepping every cell, random cells are
+picked one event at a time. A growth event on an empty cell plants a tree
+and joins it to the clusters around it (union-find), a lightning event on
+a tree burns its whole cluster at once. Only the cells of the burnt
+cluster are visited, and as a cluster always burns entirely, no cluster
+ever has to be split.
+
+*/
+
+#ifndef FORESTFIRE_CLUSTER_FOREST_H
+#define FORESTFIRE_CLUSTER_FOREST_H
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "lattice.h"
+
+class ClusterForest {
+  public:
+    // the clusters of the trees of the grid and the fires to put out at the
+    // next step (at start and when resumed)
+    template <class Stencil>
+    void init(const Grid & grid) {
+        int cells(grid.rows * grid.cols);
+        parent.assign(cells, 0);
+        size.assign(cells, 0);
+        burning.clear();
+        for (int i=0; i<cells; i++) {
+            parent[i] = i;
+            size[i] = 1;
+            if (grid[i / grid.cols][i % grid.cols] == FIRE)
+                burning.push_back(i);
+        }
+        for (int i=0; i<cells; i++)
+            if (grid[i / grid.cols][i % grid.cols] == TREE)
+                join<Stencil>(grid, i);
+    }
+
+    // one unit of time: as many events as the cells would draw in one
+    // step of the cellular automaton. The cells burnt during the step are
+    // FIRE until the next one so that they can be drawn.
+    template <class Stencil, class URNG>
+    void step(Grid & grid, int treeOdds, int fireOdds, URNG & gen,
+              Observables & changes) {
+        for (int i : burning) {
+            if (grid[i / grid.cols][i % grid.cols] == FIRE) {
+                grid[i / grid.cols][i % grid.cols] = EMPTY;
+                changes.burntOut++;
+            }
+        }
+        burning.clear();
+        double growth(1.0 / treeOdds);
+        double lightning(fireOdds ? 1.0 / fireOdds : 0.0);
+        int cells(grid.rows * grid.cols);
+        long long events((long long)(cells * (growth + lightning) + 0.5));
+        std::uniform_int_distribution<int> pick(0, cells - 1);
+        std::bernoulli_distribution grows(growth / (growth + lightning));
+        for (long long e=0; e<events; e++) {
+            int i(pick(gen));
+            uint8_t & state(grid[i / grid.cols][i % grid.cols]);
+            if (grows(gen)) {
+                if (state != TREE) { // a burnt cell is empty already
+                    if (state == FIRE)
+                        changes.burntOut++;
+                    state = TREE;
+                    parent[i] = i;
+                    size[i] = 1;
+                    join<Stencil>(grid, i);
+                    changes.grown++;
+                }
+            }
+            else if (state == TREE) {
+                changes.struck++;
+                changes.lit += size[find(i)] - 1;
+                burn<Stencil>(grid, i);
+            }
+        }
+    }
+
+  private:
+    std::vector<int> parent;
+    std::vector<int> size; // of the clusters, at their roots
+    std::vector<int> burning; // cells burnt during the last step
+    std::vector<int> stack;
+
+    int find(int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]]; // path halving
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // calls f(cell) for the neighbors inside the grid or across a
+    // periodic boundary
+    template <class Stencil, class Function>
+    void for_each_neighbor_cell(const Grid & grid, int i, Function f) const {
+        int row(i / grid.cols), col(i % grid.cols);
+        const int (*offsets)[2](Stencil::offsets(Stencil::parity(row, col)));
+        for (int k=0; k<Stencil::size; k++) {
+            int r(row + offsets[k][0]), c(col + offsets[k][1]);
+            if (grid.boundary == PERIODIC) {
+                r = (r + grid.rows) % grid.rows;
+                c = (c + grid.cols) % grid.cols;
+            }
+            else if (r < 0 || r >= grid.rows || c < 0 || c >= grid.cols) {
+                continue;
+            }
+            f(r * grid.cols + c);
+        }
+    }
+
+    // joins the tree i to the trees around it (union by size)
+    template <class Stencil>
+    void join(const Grid & grid, int i) {
+        for_each_neighbor_cell<Stencil>(grid, i, [this, &grid, i](int j) {
+            if (grid[j / grid.cols][j % grid.cols] != TREE)
+                return;
+            int a(find(i)), b(find(j));
+            if (a == b)
+                return;
+            if (size[a] < size[b])
+                std::swap(a, b);
+            parent[b] = a;
+            size[a] += size[b];
+        });
+    }
+
+    // sets the whole cluster of i on fire, its cells are only visited to
+    // be drawn, its size is the one of the union-find
+    template <class Stencil>
+    void burn(Grid & grid, int i) {
+        stack.assign(1, i);
+        grid[i / grid.cols][i % grid.cols] = FIRE;
+        while (!stack.empty()) {
+            int j(stack.back());
+            stack.pop_back();
+            burning.push_back(j);
+            for_each_neighbor_cell<Stencil>(grid, j, [this, &grid](int k) {
+                uint8_t & state(grid[k / grid.cols][k % grid.cols]);
+                if (state == TREE) {
+                    state = FIRE;
+                    stack.push_back(k);
+                }
+            });
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,160 @@
+/*
+
+Halo exchange between processes that each own a strip of rows of the
+grid: a shared mapping created before fork holds the edge rows of every
+strip, the populations of every strip and optionally a gathered frame,
+and a process-shared barrier separates the steps.
+
+Every buffer is doubled and picked by the parity of the step, so one
+barrier per step is enough: a buffer is only written again after every
+process has passed the next barrier, so after it was read.
+
+*/
+
+#ifndef FORESTFIRE_HALO_EXCHANGE_H
+#define FORESTFIRE_HALO_EXCHANGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "lattice.h"
+
+#define TOP 0
+#define BOTTOM 1
+
+class HaloExchange {
+  public:
+    HaloExchange() : rows(0), cols(0), haloRows(0), data(0), size(0),
+                     barrier(0), edges(0), populations(0), frames(0) {}
+    // only unmapped, the parent destroys the barrier with close()
+    ~HaloExchange() {
+        if (data)
+            munmap(data, size);
+    }
+
+    // before fork: firstRows[s] is the first row of the strip s, withFrames
+    // to gather whole grids for the recordings
+    bool open(const std::vector<int> & firstRows, int r, int c, int halo,
+              bool withFrames) {
+        first = firstRows;
+        rows = r;
+        cols = c;
+        haloRows = halo;
+        std::size_t edgeBytes((std::size_t)strips() * 2 * 2 * haloRows * cols);
+        std::size_t populationBytes(strips() * 2 * sizeof(Observables));
+        std::size_t frameBytes(withFrames ? 2 * (std::size_t)rows * cols : 0);
+        size = ALIGN + edgeBytes + populationBytes + frameBytes;
+        void * mapped(mmap(0, size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+        if (mapped == MAP_FAILED) {
+            std::cerr << "can't map " << size << " bytes of shared memory" << std::endl;
+            return false;
+        }
+        data = (uint8_t *)mapped;
+        barrier = (pthread_barrier_t *)data;
+        populations = (Observables *)(data + ALIGN);
+        edges = data + ALIGN + populationBytes;
+        frames = withFrames ? edges + edgeBytes : 0;
+        pthread_barrierattr_t attributes;
+        pthread_barrierattr_init(&attributes);
+        pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        bool ok(pthread_barrier_init(barrier, &attributes, strips()) == 0);
+        pthread_barrierattr_destroy(&attributes);
+        return ok;
+    }
+
+    // by the parent once every process has ended
+    void close() {
+        if (barrier)
+            pthread_barrier_destroy(barrier);
+        barrier = 0;
+    }
+
+    int strips() const { return first.size(); }
+    int first_row(int s) const { return first[s]; }
+    int strip_rows(int s) const {
+        return (s + 1 < strips() ? first[s + 1] : rows) - first[s];
+    }
+
+    void wait() { pthread_barrier_wait(barrier); }
+
+    // the rows of the strip its neighbors need, before the barrier
+    void publish(int s, const Grid & grid, uint64_t step) {
+        for (int k=0; k<haloRows; k++) {
+            std::memcpy(edge(s, step, TOP, k), grid[k], cols);
+            std::memcpy(edge(s, step, BOTTOM, k), grid[strip_rows(s) - haloRows + k], cols);
+        }
+    }
+
+    // the rows of the neighbors into the halo, after the barrier (the first
+    // and last strips keep the empty halo of the fixed boundary)
+    void receive(int s, Grid & grid, uint64_t step) const {
+        for (int k=0; k<haloRows; k++) {
+            if (s > 0)
+                std::memcpy(grid[k - haloRows], edge(s - 1, step, BOTTOM, k), cols);
+            if (s + 1 < strips())
+                std::memcpy(grid[strip_rows(s) + k], edge(s + 1, step, TOP, k), cols);
+        }
+    }
+
+    // the populations of the strip after the step
+    void put_populations(int s, uint64_t step, const Observables & observables) {
+        populations[s * 2 + step % 2] = observables;
+    }
+
+    // the sums over the strips, after the next barrier
+    Observables gather_populations(uint64_t step) const {
+        Observables sum;
+        for (int s=0; s<strips(); s++) {
+            const Observables & o(populations[s * 2 + step % 2]);
+            sum.trees += o.trees;
+            sum.fires += o.fires;
+            sum.burnedArea += o.burnedArea;
+            sum.grown += o.grown;
+            sum.struck += o.struck;
+            sum.lit += o.lit;
+            sum.burntOut += o.burntOut;
+            sum.perimeter += o.perimeter;
+        }
+        return sum;
+    }
+
+    // the cells of the strip into the whole grid, after the step
+    void put_frame(int s, const Grid & grid, uint64_t step) {
+        uint8_t * out(frames + (step % 2) * rows * cols + (std::size_t)first[s] * cols);
+        for (int r=0; r<strip_rows(s); r++)
+            std::memcpy(out + (std::size_t)r * cols, grid[r], cols);
+    }
+
+    // after the next barrier, into a grid of the whole size
+    void gather_frame(Grid & grid, uint64_t step) const {
+        const uint8_t * in(frames + (step % 2) * rows * cols);
+        for (int r=0; r<rows; r++)
+            std::memcpy(grid[r], in + (std::size_t)r * cols, cols);
+    }
+
+  private:
+    static const std::size_t ALIGN = 256; // room for the barrier
+
+    std::vector<int> first;
+    int rows;
+    int cols;
+    int haloRows;
+    uint8_t * data;
+    std::size_t size;
+    pthread_barrier_t * barrier;
+    uint8_t * edges;
+    Observables * populations;
+    uint8_t * frames;
+
+    uint8_t * edge(int s, uint64_t step, int side, int k) const {
+        return edges + ((((std::size_t)s * 2 + step % 2) * 2 + side) * haloRows + k) * cols;
+    }
+};
+
+#endif
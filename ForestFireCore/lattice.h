@@ -0,0 +1,454 @@
+/*
+
+Lattice engine shared by all the scripts: the grid, the neighbors of the
+square, hexagonal and triangular tilings and the Drossel-Schwabl step
+
+*/
+
+#ifndef FORESTFIRE_LATTICE_H
+#define FORESTFIRE_LATTICE_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <random>
+#include <vector>
+
+#include "skip_sampler.h"
+#include "philox.h"
+
+#define EMPTY 0
+#define TREE 1
+#define FIRE 2 // FIRE+k burns k more steps before becoming empty
+
+// what is around the grid
+#define FIXED 0 // empty cells that never change
+#define PERIODIC 1 // the opposite side (even rows and columns for hexagons
+                   // and triangles so that the parities match)
+
+// random numbers of the growth and the lightning
+#define STD_RAND 0 // one random number for each cell
+#define SKIP_SAMPLING 1 // one random number per event instead of per cell
+#define COUNTER 2 // the number of a cell only depends on (seed, step, cell)
+
+// neighbor offsets {row, col}, indexed by the parity of the cell
+constexpr int vonNeumannOffsets[1][4][2] = {{        {-1, 0},
+                                             {0, -1},         {0, 1},
+                                                      {1, 0}}};
+constexpr int mooreOffsets[1][8][2] = {{{-1, -1}, {-1, 0}, {-1, 1},
+                                        {0, -1},            {0, 1},
+                                        {1, -1},   {1, 0},  {1, 1}}};
+// odd rows are offset by half a tile
+constexpr int hexagonalOffsets[2][6][2] = {
+{{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, -1}, {1, 0}}, // even rows
+{{-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, 0}, {1, 1}}};  // odd rows
+constexpr int triangularSideOffsets[2][3][2] = {
+{{0, -1}, {-1, 0}, {1, 0}},  // when row%2 == col%2
+{{-1, 0}, {1, 0}, {0, 1}}};  // when row%2 != col%2
+constexpr int triangularAllOffsets[2][12][2] = {
+{{2, 0}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-2, 0}, {-2, -1}, {-1, -1}, {0, -1}, {1, -1}, {2, -1}},
+{{2, 1}, {1, 1}, {0, 1}, {-1, 1}, {-2, 1}, {-2, 0}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}, {1, 0}, {2, 0}}};
+
+// the stencils: amount of neighbors, parity of a cell and offsets
+struct VonNeumann {
+    static const int size = 4;
+    static const int parities = 1;
+    static const bool rowParity = true; // the parity only depends on the row
+    static int parity(int, int) { return 0; }
+    static const int (*offsets(int p))[2] { return vonNeumannOffsets[p]; }
+};
+
+struct Moore {
+    static const int size = 8;
+    static const int parities = 1;
+    static const bool rowParity = true;
+    static int parity(int, int) { return 0; }
+    static const int (*offsets(int p))[2] { return mooreOffsets[p]; }
+};
+
+struct Hexagonal {
+    static const int size = 6;
+    static const int parities = 2;
+    static const bool rowParity = true;
+    static int parity(int row, int) { return row%2; }
+    static const int (*offsets(int p))[2] { return hexagonalOffsets[p]; }
+};
+
+struct TriangularSide {
+    static const int size = 3;
+    static const int parities = 2;
+    static const bool rowParity = false;
+    static int parity(int row, int col) { return row%2 != col%2; }
+    static const int (*offsets(int p))[2] { return triangularSideOffsets[p]; }
+};
+
+struct TriangularAll {
+    static const int size = 12;
+    static const int parities = 2;
+    static const bool rowParity = false;
+    static int parity(int row, int col) { return row%2 != col%2; }
+    static const int (*offsets(int p))[2] { return triangularAllOffsets[p]; }
+};
+
+// rectangular grid of cells, grid[row][col], one byte per cell
+// the rows are contiguous and surrounded by a halo of HALO cells so that
+// the neighbors can be read without checking the bounds, and there are
+// two buffers: a step reads the current one and writes the next one
+#define HALO 2 // the triangular tiling reaches two rows away
+
+class Grid {
+  public:
+    int rows;
+    int cols;
+    int boundary;
+
+    Grid() : rows(0), cols(0), boundary(FIXED), stride(0), current(0) {}
+    Grid(int r, int c, int state=EMPTY, int b=FIXED)
+        : rows(0), cols(0), boundary(b), stride(0), current(0) {
+        init(r, c, state, b);
+    }
+
+    // the memory is kept when the size doesn't change
+    void init(int r, int c, int state=EMPTY, int b=FIXED) {
+        rows = r;
+        cols = c;
+        boundary = b;
+        stride = cols + 2*HALO;
+        for (int i=0; i<2; i++)
+            cells[i].assign((std::size_t)(rows + 2*HALO) * stride, EMPTY);
+        current = 0;
+        for (int i=0; i<rows; i++)
+            std::memset((*this)[i], state, cols);
+        sync();
+    }
+
+    uint8_t * operator[](int row) { return &cells[current][index(row)]; }
+    const uint8_t * operator[](int row) const { return &cells[current][index(row)]; }
+    // row of the buffer being written
+    uint8_t * next(int row) { return &cells[1-current][index(row)]; }
+
+    // the written buffer becomes the current one
+    void swap() { current = 1 - current; }
+
+    // copies the current buffer into the next one (cells set by hand)
+    void sync() { cells[1-current] = cells[current]; }
+
+    // copies the cells of a grid of the same size (snapshots)
+    void copy_cells(const Grid & other) { cells[current] = other.cells[other.current]; }
+
+    // copies the opposite sides into the halo of the current buffer
+    void fill_halo() {
+        if (boundary != PERIODIC)
+            return;
+        for (int r=0; r<rows; r++) {
+            uint8_t * row((*this)[r]);
+            for (int k=1; k<=HALO; k++) {
+                row[-k] = row[cols - k];
+                row[cols + k - 1] = row[k - 1];
+            }
+        }
+        for (int k=1; k<=HALO; k++) {
+            std::memcpy((*this)[-k] - HALO, (*this)[rows - k] - HALO, stride);
+            std::memcpy((*this)[rows + k - 1] - HALO, (*this)[k - 1] - HALO, stride);
+        }
+    }
+
+  private:
+    int stride; // cells per row with the halo
+    std::vector<uint8_t> cells[2];
+    int current; // buffer read by the step
+
+    std::size_t index(int row) const {
+        return (std::size_t)(row + HALO) * stride + HALO;
+    }
+};
+
+// calls f(row, col) for each neighbor inside the grid, the parity of the
+// cell is a template parameter so that the offsets are constants
+template <class Stencil, int Parity, class Function>
+inline void for_each_neighbor_p(const Grid & grid, int row, int col,
+                                Function f) {
+    const int (*offsets)[2](Stencil::offsets(Parity % Stencil::parities));
+    for (int n=0; n<Stencil::size; n++) {
+        int newR(row + offsets[n][0]);
+        if (newR < 0 || newR >= grid.rows) // check if out of grid
+            continue;
+        int newC(col + offsets[n][1]);
+        if (newC < 0 || newC >= grid.cols) // check if out of grid
+            continue;
+        f(newR, newC);
+    }
+}
+
+template <class Stencil, class Function>
+inline void for_each_neighbor(const Grid & grid, int row, int col,
+                              Function f) {
+    if (Stencil::parity(row, col))
+        for_each_neighbor_p<Stencil, 1>(grid, row, col, f);
+    else
+        for_each_neighbor_p<Stencil, 0>(grid, row, col, f);
+}
+
+// number of neighbors that satisfy the predicate, the cells out of the
+// grid are read in the halo
+template <class Stencil, int Parity, class Predicate>
+inline int count_neighbors_p(const Grid & grid, int row, int col,
+                             Predicate p) {
+    const int (*offsets)[2](Stencil::offsets(Parity % Stencil::parities));
+    int count(0);
+    for (int n=0; n<Stencil::size; n++)
+        count += p(grid[row + offsets[n][0]][col + offsets[n][1]]);
+    return count;
+}
+
+// true as soon as a neighbor satisfies the predicate, the cells out of
+// the grid are read in the halo
+template <class Stencil, int Parity, class Predicate>
+inline bool any_neighbor_p(const Grid & grid, int row, int col,
+                           Predicate p) {
+    const int (*offsets)[2](Stencil::offsets(Parity % Stencil::parities));
+    for (int n=0; n<Stencil::size; n++) {
+        if (p(grid[row + offsets[n][0]][col + offsets[n][1]]))
+            return true;
+    }
+    return false;
+}
+
+template <class Stencil, class Predicate>
+inline bool any_neighbor(const Grid & grid, int row, int col, Predicate p) {
+    if (Stencil::parity(row, col))
+        return any_neighbor_p<Stencil, 1>(grid, row, col, p);
+    return any_neighbor_p<Stencil, 0>(grid, row, col, p);
+}
+
+// random growth and lightning, see RNG in the scripts
+// the sequential modes draw from their own generator instead of rand() so
+// that the whole state can be saved and restored
+class RandomEvents {
+  public:
+    int mode;
+    int treeOdds; // new tree probability 1/p
+    int fireOdds; // fire probability 1/f, 0 for no lightning
+    unsigned long long seed;
+    unsigned long long step;
+    unsigned firstCell; // added to the cells (COUNTER), for a part of a bigger grid
+
+    RandomEvents(int m, int p, int f)
+        : mode(m), treeOdds(p), fireOdds(f), seed(0), step(0), firstCell(0),
+          treeSampler(1.0/p), fireSampler(f ? 1.0/f : 1.0) {}
+
+    // before the first step
+    void set_seed(unsigned long long s) {
+        seed = s;
+        std::seed_seq seq{(unsigned)s, (unsigned)(s >> 32)};
+        generator.seed(seq);
+    }
+
+    bool tree_grows(int cell) { return event(treeSampler, treeOdds, cell, TREE_STREAM); }
+    bool lightning(int cell) { return event(fireSampler, fireOdds, cell, FIRE_STREAM); }
+
+    // everything the next draws depend on, as text
+    void save(std::ostream & out) const {
+        out << seed << " " << step << " " << treeSampler.remaining() << " "
+            << fireSampler.remaining() << " " << generator;
+    }
+
+    bool load(std::istream & in) {
+        long long treeLeft, fireLeft;
+        in >> seed >> step >> treeLeft >> fireLeft >> generator;
+        treeSampler.restore(treeLeft);
+        fireSampler.restore(fireLeft);
+        return !in.fail();
+    }
+
+  private:
+    SkipSampler treeSampler;
+    SkipSampler fireSampler;
+    std::mt19937 generator;
+
+    bool event(SkipSampler & sampler, int odds, int cell, int stream) {
+        if (mode == SKIP_SAMPLING)
+            return sampler.hit(generator);
+        if (mode == COUNTER)
+            return cell_random(seed, step, firstCell + cell, stream) % odds == 0;
+        return generator() % odds == 0;
+    }
+};
+
+// populations kept up to date from the changes of the cells during the
+// steps instead of counting the whole grid
+struct Observables {
+    long long trees;
+    long long fires; // burning cells, whatever their persistance
+    long long burnedArea; // cells that caught fire since the start
+    // changes during the last step
+    long long grown;
+    long long struck; // trees lit by lightning
+    long long lit; // trees lit by a burning neighbor
+    long long burntOut; // fires that ended
+    long long perimeter; // tree-fire edges at the start of the step, the
+                         // burning front the fire could spread through
+
+    Observables() : trees(0), fires(0), burnedArea(0), grown(0), struck(0),
+                    lit(0), burntOut(0), perimeter(0) {}
+
+    // once, when the cells were set by hand
+    void count(const Grid & grid, int border=0) {
+        trees = fires = 0;
+        for (int r=border; r<grid.rows-border; r++) {
+            const uint8_t * row(grid[r]);
+            for (int c=border; c<grid.cols-border; c++) {
+                trees += row[c] == TREE;
+                fires += row[c] >= FIRE;
+            }
+        }
+    }
+
+    // adds the changes of a step
+    void apply(const Observables & step) {
+        grown = step.grown;
+        struck = step.struck;
+        lit = step.lit;
+        burntOut = step.burntOut;
+        perimeter = step.perimeter;
+        trees += grown - struck - lit;
+        fires += struck + lit - burntOut;
+        burnedArea += struck + lit;
+    }
+};
+
+// parameters of the Drossel-Schwabl step
+struct Rules {
+    int persistance; // extra steps a fire burns
+    int steppedRows; // the rows after are never changed
+};
+
+// the rules of a cell, shared by the steps: burningAround() gives the
+// number of burning neighbors of a tree, counted as its edges of the front
+template <class BurningAround>
+inline uint8_t ds_rules(uint8_t state, int cell, BurningAround burningAround,
+                        const Rules & rules, RandomEvents & random,
+                        Observables & changes) {
+    // tested in turn rather than with a switch, the compiler would jump
+    // through a table whose target is hard to predict
+    if (state == EMPTY) {
+        if (!random.tree_grows(cell))
+            return EMPTY;
+        changes.grown++;
+        return TREE;
+    }
+    if (state == TREE) {
+        int burning(burningAround());
+        changes.perimeter += burning;
+        // can randomly become a fire or put on fire if one is around
+        if (random.fireOdds && random.lightning(cell)) {
+            changes.struck++;
+            return FIRE + rules.persistance;
+        }
+        if (burning) {
+            changes.lit++;
+            return FIRE + rules.persistance;
+        }
+        return TREE;
+    }
+    if (state == FIRE) {
+        changes.burntOut++;
+        return EMPTY;
+    }
+    return state - 1; // older fire
+}
+
+template <class Stencil, int Parity>
+inline uint8_t ds_cell(const Grid & grid, int row, int col, uint8_t state,
+                       const Rules & rules, RandomEvents & random,
+                       Observables & changes) {
+    return ds_rules(state, row*grid.cols + col, [&]() {
+        return count_neighbors_p<Stencil, Parity>(grid, row, col, [](uint8_t s) {
+            return s >= FIRE;
+        });
+    }, rules, random, changes);
+}
+
+// the burning neighbors of each cell of the row: each neighbor is
+// read as a whole shifted row, without branches, so the loops are
+// vectorised (for the stencils whose parity only depends on the row)
+template <class Stencil, int Parity>
+inline void burning_around(const Grid & grid, int row, uint8_t * __restrict burning) {
+    const int (*offsets)[2](Stencil::offsets(Parity % Stencil::parities));
+    if (grid.cols <= 0) // nothing to gather, and the size of memset stays positive
+        return;
+    std::memset(burning, 0, grid.cols);
+    for (int n=0; n<Stencil::size; n++) {
+        const uint8_t * __restrict in(grid[row + offsets[n][0]] + offsets[n][1]);
+        for (int c=0; c<grid.cols; c++)
+            burning[c] += in[c] >= FIRE;
+    }
+}
+
+// the rules of ds_cell for a whole row with the burning neighbors gathered
+// first, the random numbers are drawn for the same cells in the same order
+// (the changes are counted locally, the stores to the row could alias them)
+template <class Stencil, int Parity>
+void ds_row(const Grid & grid, int row, uint8_t * out, uint8_t * burning,
+            const Rules & rules, RandomEvents & random, Observables & changes) {
+    burning_around<Stencil, Parity>(grid, row, burning);
+    const uint8_t * in(grid[row]);
+    Observables local;
+    for (int c=0; c<grid.cols; c++) {
+        out[c] = ds_rules(in[c], row*grid.cols + c, [burning, c]() {
+            return burning[c];
+        }, rules, random, local);
+    }
+    changes.grown += local.grown;
+    changes.struck += local.struck;
+    changes.lit += local.lit;
+    changes.burntOut += local.burntOut;
+    changes.perimeter += local.perimeter;
+}
+
+// the rows first to last-1 of a step, the changes are added
+template <class Stencil>
+void ds_rows(Grid & grid, const Rules & rules, RandomEvents & random,
+             int first, int last, Observables & changes) {
+    if (Stencil::rowParity) {
+        std::vector<uint8_t> burning(grid.cols);
+        for (int r=first; r<last; r++) {
+            if (Stencil::parity(r, 0))
+                ds_row<Stencil, 1>(grid, r, grid.next(r), &burning[0], rules, random, changes);
+            else
+                ds_row<Stencil, 0>(grid, r, grid.next(r), &burning[0], rules, random, changes);
+        }
+        return;
+    }
+    for (int r=first; r<last; r++) {
+        const uint8_t * in(grid[r]);
+        uint8_t * out(grid.next(r));
+        for (int c=0; c<grid.cols; c++) {
+            if (Stencil::parity(r, c))
+                out[c] = ds_cell<Stencil, 1>(grid, r, c, in[c], rules, random, changes);
+            else
+                out[c] = ds_cell<Stencil, 0>(grid, r, c, in[c], rules, random, changes);
+        }
+    }
+}
+
+// one step of growth, lightning and propagation: reads the current buffer
+// and writes the next one in a single pass, the observables are updated
+// from the cells that changed if given
+template <class Stencil>
+void ds_step(Grid & grid, const Rules & rules, RandomEvents & random,
+             Observables * observables=0) {
+    random.step++;
+    grid.fill_halo();
+    Observables changes;
+    ds_rows<Stencil>(grid, rules, random, 0, rules.steppedRows, changes);
+    for (int r=rules.steppedRows; r<grid.rows; r++)
+        std::memcpy(grid.next(r), grid[r], grid.cols);
+    grid.swap();
+    if (observables)
+        observables->apply(changes);
+}
+
+#endif
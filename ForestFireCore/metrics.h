@@ -0,0 +1,206 @@
+/*
+
+Latency histograms and counters of the GUI scripts: cheap enough to stay
+always on (two clock reads and a few relaxed atomic adds per measure),
+dumped as csv and json on exit or when the process gets a signal
+
+*/
+
+#ifndef FORESTFIRE_METRICS_H
+#define FORESTFIRE_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// latencies in fixed buckets: 4 per power of two from 1 us to about 16 s,
+// bucket i holds the values below 2^((i+1)/4) us
+class Histogram {
+  public:
+    static const int BUCKETS = 96;
+    std::string name;
+
+    Histogram(const std::string & n) : name(n), total(0), sum(0), maximum(0) {
+        for (int i=0; i<BUCKETS; i++)
+            counts[i] = 0;
+    }
+
+    // one writer per histogram, the readers only see complete counts
+    void record(double us) {
+        int i(us < 1.0 ? 0 : (int)(4.0 * std::log2(us)));
+        if (i >= BUCKETS)
+            i = BUCKETS - 1;
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add((uint64_t)(us * 1000.0), std::memory_order_relaxed);
+        if ((uint64_t)us > maximum.load(std::memory_order_relaxed))
+            maximum.store((uint64_t)us, std::memory_order_relaxed);
+    }
+
+    static double upper_bound(int bucket) { return std::exp2((bucket + 1) / 4.0); }
+
+    uint64_t count() const { return total; }
+    uint64_t bucket(int i) const { return counts[i]; }
+    double mean() const { return total ? (double)sum / total / 1000.0 : 0.0; }
+    double max() const { return (double)maximum; }
+
+    // upper bound of the bucket holding the quantile q (at most the max)
+    double percentile(double q) const {
+        uint64_t n(total), seen(0);
+        if (n == 0)
+            return 0.0;
+        for (int i=0; i<BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= q * n)
+                return std::min(upper_bound(i), max());
+        }
+        return max();
+    }
+
+  private:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum; // ns
+    std::atomic<uint64_t> maximum; // us
+};
+
+struct Counter {
+    std::string name;
+    std::atomic<uint64_t> value;
+
+    Counter(const std::string & n) : name(n), value(0) {}
+    void add(uint64_t n=1) { value.fetch_add(n, std::memory_order_relaxed); }
+};
+
+// records the time from its creation to its destruction
+class ScopedTimer {
+  public:
+    ScopedTimer(Histogram * h) : histogram(h), start(Clock::now()) {}
+    ~ScopedTimer() {
+        if (histogram)
+            histogram->record(std::chrono::duration<double, std::micro>(
+                Clock::now() - start).count());
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+    Histogram * histogram;
+    Clock::time_point start;
+};
+
+class Metrics {
+  public:
+    Metrics() : lastOverlay(std::chrono::steady_clock::now()) {}
+
+    // to call before the threads start, the references stay valid
+    Histogram & histogram(const std::string & name) {
+        for (Histogram & h : histograms)
+            if (h.name == name)
+                return h;
+        histograms.emplace_back(name);
+        return histograms.back();
+    }
+
+    Counter & counter(const std::string & name) {
+        for (Counter & c : counters)
+            if (c.name == name)
+                return c;
+        counters.emplace_back(name);
+        return counters.back();
+    }
+
+    // the next dump_requested() is true when the process gets the signal
+    static void dump_on_signal(int signal) {
+        std::signal(signal, [](int) { dump_flag() = 1; });
+    }
+
+    static bool dump_requested() {
+        if (!dump_flag())
+            return false;
+        dump_flag() = 0;
+        return true;
+    }
+
+    // writes prefix.csv and prefix.json
+    void dump(const std::string & prefix) const {
+        std::ofstream csv(prefix + ".csv");
+        csv << "metric,count,mean_us,p50_us,p90_us,p99_us,max_us" << std::endl;
+        for (const Histogram & h : histograms)
+            csv << h.name << "," << h.count() << "," << h.mean() << ","
+                << h.percentile(0.5) << "," << h.percentile(0.9) << ","
+                << h.percentile(0.99) << "," << h.max() << std::endl;
+        for (const Counter & c : counters)
+            csv << c.name << "," << c.value << ",,,,," << std::endl;
+
+        std::ofstream json(prefix + ".json");
+        json << "{\n  \"histograms\": {";
+        bool first(true);
+        for (const Histogram & h : histograms) {
+            json << (first ? "\n" : ",\n") << "    \"" << h.name << "\": {"
+                 << "\"count\": " << h.count() << ", \"mean_us\": " << h.mean()
+                 << ", \"p50_us\": " << h.percentile(0.5)
+                 << ", \"p90_us\": " << h.percentile(0.9)
+                 << ", \"p99_us\": " << h.percentile(0.99)
+                 << ", \"max_us\": " << h.max() << ", \"buckets\": [";
+            // only the buckets in use, as [upper bound us, count]
+            bool firstBucket(true);
+            for (int i=0; i<Histogram::BUCKETS; i++) {
+                if (h.bucket(i) == 0)
+                    continue;
+                json << (firstBucket ? "" : ", ") << "[" << Histogram::upper_bound(i)
+                     << ", " << h.bucket(i) << "]";
+                firstBucket = false;
+            }
+            json << "]}";
+            first = false;
+        }
+        json << "\n  },\n  \"counters\": {";
+        first = true;
+        for (const Counter & c : counters) {
+            json << (first ? "\n" : ",\n") << "    \"" << c.name << "\": " << c.value;
+            first = false;
+        }
+        json << "\n  }\n}" << std::endl;
+    }
+
+    // one line for the window title: rate of each counter since the last
+    // call and median of each histogram
+    std::string overlay() {
+        auto now(std::chrono::steady_clock::now());
+        double seconds(std::chrono::duration<double>(now - lastOverlay).count());
+        lastOverlay = now;
+        std::ostringstream res;
+        res.precision(3);
+        std::size_t i(0);
+        for (const Counter & c : counters) {
+            uint64_t value(c.value);
+            if (i >= lastValues.size())
+                lastValues.push_back(0);
+            res << c.name << " " << (value - lastValues[i]) / seconds << "/s  ";
+            lastValues[i++] = value;
+        }
+        for (const Histogram & h : histograms)
+            res << h.name << " " << h.percentile(0.5) << "us  ";
+        return res.str();
+    }
+
+  private:
+    std::deque<Histogram> histograms;
+    std::deque<Counter> counters;
+    std::chrono::steady_clock::time_point lastOverlay;
+    std::deque<uint64_t> lastValues;
+
+    static volatile std::sig_atomic_t & dump_flag() {
+        static volatile std::sig_atomic_t flag(0);
+        return flag;
+    }
+};
+
+#endif
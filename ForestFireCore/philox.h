@@ -0,0 +1,58 @@
+/*
+
+Counter-based random numbers (Philox4x32-10, Salmon et al. 2011)
+
+The number of a cell is a function of (seed, step, cell, stream) only, so
+the cells can be drawn in any order, by any thread, and a run can be
+replayed exactly from its seed.
+
+*/
+
+#ifndef FORESTFIRE_PHILOX_H
+#define FORESTFIRE_PHILOX_H
+
+#include <cstdint>
+
+// independent streams for the different random events of a cell
+#define TREE_STREAM 0
+#define FIRE_STREAM 1
+
+inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t & hi) {
+    uint64_t product((uint64_t)a * b);
+    hi = product >> 32;
+    return (uint32_t)product;
+}
+
+// 10 rounds of Philox4x32 on the counter (c0, c1, c2, c3), returns 4 words
+inline void philox4x32(uint32_t c[4], uint32_t k0, uint32_t k1) {
+    for (int round=0; round<10; round++) {
+        uint32_t hi0, hi1;
+        uint32_t lo0(mulhilo(0xD2511F53, c[0], hi0));
+        uint32_t lo1(mulhilo(0xCD9E8D57, c[2], hi1));
+        uint32_t n0(hi1 ^ c[1] ^ k0);
+        uint32_t n2(hi0 ^ c[3] ^ k1);
+        c[0] = n0;
+        c[1] = lo1;
+        c[2] = n2;
+        c[3] = lo0;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+}
+
+inline uint32_t cell_random(uint64_t seed, uint64_t step, uint32_t cell,
+                            uint32_t stream) {
+    uint32_t c[4] = {cell, stream, (uint32_t)step, (uint32_t)(step >> 32)};
+    philox4x32(c, (uint32_t)seed, (uint32_t)(seed >> 32));
+    return c[0];
+}
+
+// numbers of the cells first, first+1, ..., first+count-1 (one row)
+// written as a plain loop so that the compiler can vectorise it
+inline void row_random(uint64_t seed, uint64_t step, uint32_t first,
+                       int count, uint32_t stream, uint32_t * out) {
+    for (int i=0; i<count; i++)
+        out[i] = cell_random(seed, step, first + i, stream);
+}
+
+#endif
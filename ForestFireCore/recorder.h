@@ -0,0 +1,249 @@
+/*
+
+Binary recording of a run: every Nth step is written as a keyframe (the
+cells) or as a delta (the cells XOR the previous recorded frame), both
+run-length encoded. The encoding and the writes are done by a background
+thread, the simulation only copies the cells.
+
+File: RecordHeader, then for each frame a FrameHeader and its payload
+(native byte order, the files are read back on the same machine)
+
+*/
+
+#ifndef FORESTFIRE_RECORDER_H
+#define FORESTFIRE_RECORDER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lattice.h"
+
+#define RECORD_MAGIC 0x43524646 // "FFRC"
+#define RECORD_VERSION 1
+#define KEYFRAME 0
+#define DELTA 1
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t every; // steps between two frames
+    uint32_t keyframeInterval; // frames between two keyframes
+    uint64_t seed;
+};
+
+struct FrameHeader {
+    uint8_t type; // KEYFRAME or DELTA
+    uint8_t padding[3];
+    uint32_t size; // bytes of the payload
+    uint64_t step;
+};
+
+// runs of equal bytes as (length, value), the length as a varint
+inline void rle_encode(const uint8_t * in, std::size_t size,
+                       std::vector<uint8_t> & out) {
+    std::size_t i(0);
+    while (i < size) {
+        std::size_t run(1);
+        while (i + run < size && in[i + run] == in[i])
+            run++;
+        for (std::size_t n=run; ; n >>= 7) {
+            if (n < 0x80) {
+                out.push_back((uint8_t)n);
+                break;
+            }
+            out.push_back((uint8_t)(n | 0x80));
+        }
+        out.push_back(in[i]);
+        i += run;
+    }
+}
+
+// false when the payload doesn't give exactly size bytes
+inline bool rle_decode(const uint8_t * in, std::size_t inSize, uint8_t * out,
+                       std::size_t size) {
+    std::size_t i(0), o(0);
+    while (i < inSize) {
+        std::size_t run(0);
+        for (int shift=0; ; shift += 7) {
+            if (i >= inSize || shift > 56)
+                return false;
+            uint8_t b(in[i++]);
+            run |= (std::size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        if (i >= inSize || run > size - o)
+            return false;
+        std::memset(out + o, in[i++], run);
+        o += run;
+    }
+    return o == size;
+}
+
+// same as rle_decode but XORs the runs into out (a delta applied in
+// place), the runs of zeros are skipped
+inline bool rle_xor(const uint8_t * in, std::size_t inSize, uint8_t * out,
+                    std::size_t size) {
+    std::size_t i(0), o(0);
+    while (i < inSize) {
+        std::size_t run(0);
+        for (int shift=0; ; shift += 7) {
+            if (i >= inSize || shift > 56)
+                return false;
+            uint8_t b(in[i++]);
+            run |= (std::size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        if (i >= inSize || run > size - o)
+            return false;
+        uint8_t value(in[i++]);
+        if (value)
+            for (std::size_t k=0; k<run; k++)
+                out[o + k] ^= value;
+        o += run;
+    }
+    return o == size;
+}
+
+class Recorder {
+  public:
+    Recorder() : file(0), rows(0), cols(0), every(1), keyframeInterval(1),
+                 closing(false), dropped(0) {}
+    ~Recorder() { close(); }
+
+    bool open(const std::string & path, int r, int c, int e,
+              int keyframes, uint64_t seed) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "can't record to " << path << std::endl;
+            return false;
+        }
+        rows = r;
+        cols = c;
+        every = e;
+        keyframeInterval = keyframes;
+        RecordHeader header = {RECORD_MAGIC, RECORD_VERSION, (uint32_t)rows,
+                               (uint32_t)cols, (uint32_t)every,
+                               (uint32_t)keyframeInterval, seed};
+        std::fwrite(&header, sizeof(header), 1, file);
+        closing = false;
+        writer = std::thread(&Recorder::run, this);
+        return true;
+    }
+
+    // from the simulation thread after each step, only every Nth step is
+    // kept, and dropped if the writer is too far behind
+    void record(const Grid & grid, uint64_t step) {
+        if (!file || step % every)
+            return;
+        std::vector<uint8_t> cells;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.size() >= MAX_PENDING) {
+                dropped++;
+                return;
+            }
+            if (!spare.empty()) {
+                cells.swap(spare.back());
+                spare.pop_back();
+            }
+        }
+        cells.resize((std::size_t)rows * cols);
+        for (int r=0; r<rows; r++)
+            std::memcpy(&cells[(std::size_t)r * cols], grid[r], cols);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(Frame());
+            pending.back().step = step;
+            pending.back().cells.swap(cells);
+        }
+        wake.notify_one();
+    }
+
+    // writes what is pending
+    void close() {
+        if (!file)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        wake.notify_one();
+        writer.join();
+        std::fclose(file);
+        file = 0;
+        if (dropped)
+            std::cerr << dropped << " recorded frames dropped" << std::endl;
+    }
+
+  private:
+    static const std::size_t MAX_PENDING = 64;
+
+    struct Frame {
+        uint64_t step;
+        std::vector<uint8_t> cells;
+    };
+
+    std::FILE * file;
+    int rows;
+    int cols;
+    int every;
+    int keyframeInterval;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Frame> pending;
+    std::vector<std::vector<uint8_t> > spare; // buffers to reuse
+    bool closing;
+    long long dropped;
+
+    void run() {
+        std::size_t size((std::size_t)rows * cols);
+        std::vector<uint8_t> previous(size), delta(size), encoded;
+        long long written(0);
+        while (true) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return closing || !pending.empty(); });
+                if (pending.empty())
+                    break;
+                frame.step = pending.front().step;
+                frame.cells.swap(pending.front().cells);
+                pending.pop_front();
+            }
+            bool keyframe(written % keyframeInterval == 0);
+            const uint8_t * payload(&frame.cells[0]);
+            if (!keyframe) {
+                for (std::size_t i=0; i<size; i++)
+                    delta[i] = frame.cells[i] ^ previous[i];
+                payload = &delta[0];
+            }
+            encoded.clear();
+            rle_encode(payload, size, encoded);
+            FrameHeader header = {(uint8_t)(keyframe ? KEYFRAME : DELTA), {0, 0, 0},
+                                  (uint32_t)encoded.size(), frame.step};
+            std::fwrite(&header, sizeof(header), 1, file);
+            std::fwrite(&encoded[0], 1, encoded.size(), file);
+            written++;
+            previous.swap(frame.cells);
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::vector<uint8_t>());
+            spare.back().swap(frame.cells);
+        }
+        std::fflush(file);
+    }
+};
+
+#endif
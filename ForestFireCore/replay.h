@@ -0,0 +1,199 @@
+/*
+
+Plays a file written by the recorder: the file is memory-mapped, an index
+of the frames is built from their headers, and a seek decodes the last
+keyframe before the frame then applies at most KEYFRAME_INTERVAL deltas.
+Playing forward or backward applies one delta in place per frame (the
+deltas are XORs, so they undo themselves).
+
+*/
+
+#ifndef FORESTFIRE_REPLAY_H
+#define FORESTFIRE_REPLAY_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lattice.h"
+#include "recorder.h"
+
+class Replay {
+  public:
+    int rows;
+    int cols;
+    int speed; // frames per tick, negative to play backward
+    bool paused;
+
+    Replay() : rows(0), cols(0), speed(1), paused(false), data(0), size(0),
+               current(0) {}
+    ~Replay() {
+        if (data)
+            munmap((void *)data, size);
+    }
+
+    bool is_open() const { return data != 0; }
+    std::size_t frames() const { return offsets.size(); }
+    std::size_t frame() const { return current; }
+    uint64_t step() const { return steps[current]; }
+
+    bool open(const std::string & path) {
+        int fd(::open(path.c_str(), O_RDONLY));
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || (std::size_t)info.st_size < sizeof(RecordHeader)) {
+            std::cerr << "can't replay " << path << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        size = info.st_size;
+        void * mapped(mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "can't map " << path << std::endl;
+            return false;
+        }
+        data = (const uint8_t *)mapped;
+        RecordHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != RECORD_MAGIC || header.version != RECORD_VERSION) {
+            std::cerr << path << " is not a recording" << std::endl;
+            munmap(mapped, size);
+            data = 0;
+            return false;
+        }
+        rows = header.rows;
+        cols = header.cols;
+        index_frames();
+        if (frames() == 0) {
+            std::cerr << path << " has no frame" << std::endl;
+            munmap(mapped, size);
+            data = 0;
+            return false;
+        }
+        cells.assign((std::size_t)rows * cols, EMPTY);
+        seek(0);
+        return true;
+    }
+
+    // any frame, from its keyframe
+    void seek(std::size_t target) {
+        std::size_t key(keyframeOf[target]);
+        rle_decode(payload(key), sizes[key], &cells[0], cells.size());
+        for (std::size_t f=key+1; f<=target; f++)
+            rle_xor(payload(f), sizes[f], &cells[0], cells.size());
+        current = target;
+    }
+
+    // the cheapest of seeking and applying the deltas in between
+    void go_to(std::size_t target) {
+        if (target >= frames())
+            target = frames() - 1;
+        std::size_t key(keyframeOf[target]);
+        if (target > current && key <= current) {
+            while (current < target) {
+                current++;
+                rle_xor(payload(current), sizes[current], &cells[0], cells.size());
+            }
+        }
+        else if (target < current && current - target <= target - key) {
+            // undoes the deltas until a keyframe is in the way
+            while (current > target && types[current] == DELTA) {
+                rle_xor(payload(current), sizes[current], &cells[0], cells.size());
+                current--;
+            }
+            if (current != target)
+                seek(target);
+        }
+        else if (target != current) {
+            seek(target);
+        }
+    }
+
+    // moves by speed frames unless paused, false when nothing changed
+    bool tick() {
+        if (paused)
+            return false;
+        std::size_t before(current);
+        if (speed < 0)
+            go_to(current > (std::size_t)-speed ? current + speed : 0);
+        else
+            go_to(current + speed);
+        if (current == before || current == 0 || current == frames() - 1)
+            paused = true; // at an end
+        return current != before;
+    }
+
+    // space: pause, r: reverse, +/-: speed, ./,: one frame when paused,
+    // 0-9: seek to a tenth of the run, false when nothing changed
+    bool key(unsigned char k) {
+        std::size_t before(current);
+        if (k == ' ')
+            paused = !paused;
+        else if (k == 'r')
+            speed = -speed;
+        else if (k == '+' && std::abs(speed) < (1 << 20))
+            speed *= 2;
+        else if (k == '-' && std::abs(speed) > 1)
+            speed /= 2;
+        else if (k == '.')
+            go_to(current + 1);
+        else if (k == ',' && current > 0)
+            go_to(current - 1);
+        else if (k >= '0' && k <= '9')
+            go_to((frames() - 1) * (k - '0') / 10);
+        return current != before;
+    }
+
+    // copies the cells of the current frame into the grid
+    void show(Grid & grid) const {
+        for (int r=0; r<rows; r++)
+            std::memcpy(grid[r], &cells[(std::size_t)r * cols], cols);
+    }
+
+  private:
+    const uint8_t * data;
+    std::size_t size;
+    std::vector<std::size_t> offsets; // of the payloads
+    std::vector<uint32_t> sizes;
+    std::vector<uint64_t> steps;
+    std::vector<uint8_t> types;
+    std::vector<std::size_t> keyframeOf; // keyframe each frame starts from
+    std::vector<uint8_t> cells;
+    std::size_t current;
+
+    const uint8_t * payload(std::size_t f) const { return data + offsets[f]; }
+
+    // stops at the first incomplete frame (a recording cut short)
+    void index_frames() {
+        std::size_t offset(sizeof(RecordHeader));
+        std::size_t key(0);
+        while (offset + sizeof(FrameHeader) <= size) {
+            FrameHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            offset += sizeof(header);
+            if (header.size > size - offset)
+                break;
+            if (header.type == KEYFRAME)
+                key = offsets.size();
+            else if (offsets.empty())
+                break; // a delta without a keyframe before it
+            offsets.push_back(offset);
+            sizes.push_back(header.size);
+            steps.push_back(header.step);
+            types.push_back(header.type);
+            keyframeOf.push_back(key);
+            offset += header.size;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,170 @@
+/*
+
+Bitsliced replicas of a square grid: the bit k of the word of a cell is the
+cell in the replica k, so one pass over the grid steps 64 independent
+simulations of the same size and neighborhood. A neighbor is a whole word,
+no shift is needed, and the loops over the cells are plain word operations
+that the compiler vectorises.
+
+*/
+
+#ifndef FORESTFIRE_REPLICA_GRID_H
+#define FORESTFIRE_REPLICA_GRID_H
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#define REPLICAS_AMOUNT 64 // bits of a word
+
+class ReplicaGrid {
+  public:
+    int rows;
+    int cols;
+    int stride; // words per row including the padding
+    std::vector<uint64_t> tree;
+    std::vector<uint64_t> fire;
+    std::vector<uint64_t> ashes; // every cell that has burnt (percolation)
+
+    ReplicaGrid() : rows(0), cols(0), stride(2) {}
+
+    // every row is padded by a zero word on both sides and the grid by a
+    // zero row above and below, the memory is kept when the size doesn't
+    // change
+    void resize(int r, int c) {
+        if (r != rows || c != cols) {
+            rows = r;
+            cols = c;
+            stride = cols + 2;
+            std::size_t size((std::size_t)(rows + 2) * stride);
+            tree.assign(size, 0);
+            fire.assign(size, 0);
+            ashes.assign(size, 0);
+            nextFire.assign(size, 0);
+        }
+        clear();
+    }
+
+    void clear() {
+        std::fill(tree.begin(), tree.end(), 0);
+        std::fill(fire.begin(), fire.end(), 0);
+        std::fill(ashes.begin(), ashes.end(), 0);
+        std::fill(nextFire.begin(), nextFire.end(), 0);
+    }
+
+    uint64_t * row(std::vector<uint64_t> & plane, int r) {
+        return &plane[(std::size_t)(r + 1) * stride + 1];
+    }
+    const uint64_t * row(const std::vector<uint64_t> & plane, int r) const {
+        return &plane[(std::size_t)(r + 1) * stride + 1];
+    }
+
+    bool get(const std::vector<uint64_t> & plane, int r, int c, int replica) const {
+        return (row(plane, r)[c] >> replica) & 1;
+    }
+
+    void set(std::vector<uint64_t> & plane, int r, int c, int replica, bool value) {
+        uint64_t & w(row(plane, r)[c]);
+        uint64_t bit(1ULL << replica);
+        w = value ? (w | bit) : (w & ~bit);
+    }
+
+    // cells of each replica, without the border cells if interior
+    std::vector<long long> count(const std::vector<uint64_t> & plane,
+                                 bool interior=false) const {
+        std::vector<long long> res(REPLICAS_AMOUNT, 0);
+        int border(interior ? 1 : 0);
+        for (int r=border; r<rows-border; r++) {
+            const uint64_t * p(row(plane, r));
+            for (int c=border; c<cols-border; c++)
+                for (uint64_t w=p[c]; w; w &= w - 1)
+                    res[__builtin_ctzll(w)]++;
+        }
+        return res;
+    }
+
+    // replicas with a cell of the plane next to the border
+    uint64_t next_to_border(const std::vector<uint64_t> & plane) const {
+        uint64_t res(0);
+        const uint64_t * top(row(plane, 1));
+        const uint64_t * bottom(row(plane, rows-2));
+        for (int c=1; c<cols-1; c++)
+            res |= top[c] | bottom[c];
+        for (int r=1; r<rows-1; r++)
+            res |= row(plane, r)[1] | row(plane, r)[cols-2];
+        return res;
+    }
+
+    // percolation rules: the trees next to a fire burn, the fires become
+    // ashes and the border never burns, returns the replicas with new fires
+    uint64_t burn_step(bool moore) {
+        uint64_t alive(0);
+        for (int r=1; r<rows-1; r++) {
+            uint64_t * t(row(tree, r));
+            uint64_t * nf(row(nextFire, r));
+            for (int c=1; c<cols-1; c++) {
+                nf[c] = t[c] & fire_around(r, c, moore);
+                t[c] &= ~nf[c];
+                alive |= nf[c];
+            }
+        }
+        for (int r=0; r<rows; r++) {
+            uint64_t * f(row(fire, r));
+            uint64_t * a(row(ashes, r));
+            for (int c=0; c<cols; c++)
+                a[c] |= f[c];
+        }
+        fire.swap(nextFire);
+        return alive;
+    }
+
+    // Drossel-Schwabl rules: the fires become empty, a tree burns if struck
+    // by lightning or next to a fire and an empty cell grows if in growth
+    void ds_step(bool moore, const std::vector<uint64_t> & growth,
+                 const std::vector<uint64_t> & lightning) {
+        for (int r=0; r<rows; r++) {
+            uint64_t * t(row(tree, r));
+            const uint64_t * f(row(fire, r));
+            const uint64_t * g(row(growth, r));
+            const uint64_t * l(row(lightning, r));
+            uint64_t * nf(row(nextFire, r));
+            for (int c=0; c<cols; c++) {
+                uint64_t empty(~(t[c] | f[c]));
+                nf[c] = t[c] & (fire_around(r, c, moore) | l[c]);
+                t[c] = (t[c] & ~nf[c]) | (empty & g[c]);
+            }
+        }
+        fire.swap(nextFire);
+    }
+
+    // sets each bit of each cell with probability p by drawing the gaps
+    // between the set bits from a geometric distribution
+    template <class URNG>
+    void random_mask(std::vector<uint64_t> & mask, double p, URNG & gen) {
+        mask.assign(tree.size(), 0);
+        if (p <= 0.0)
+            return;
+        std::geometric_distribution<long long> gap(p);
+        long long total((long long)rows * cols * REPLICAS_AMOUNT);
+        for (long long i=gap(gen); i<total; i += 1 + gap(gen)) {
+            long long cell(i / REPLICAS_AMOUNT);
+            set(mask, cell / cols, cell % cols, i % REPLICAS_AMOUNT, true);
+        }
+    }
+
+  private:
+    std::vector<uint64_t> nextFire;
+
+    uint64_t fire_around(int r, int c, bool moore) const {
+        const uint64_t * up(row(fire, r-1));
+        const uint64_t * mid(row(fire, r));
+        const uint64_t * down(row(fire, r+1));
+        uint64_t res(up[c] | down[c] | mid[c-1] | mid[c+1]);
+        if (moore)
+            res |= up[c-1] | up[c+1] | down[c-1] | down[c+1];
+        return res;
+    }
+};
+
+#endif
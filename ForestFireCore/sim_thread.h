@@ -0,0 +1,149 @@
+/*
+
+Runs the simulation on its own thread so that the steps are no longer
+paced by the frame timer: the display draws the last complete snapshot of
+the grid, handed over without a lock (triple buffering)
+
+*/
+
+#ifndef FORESTFIRE_SIM_THREAD_H
+#define FORESTFIRE_SIM_THREAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include "lattice.h"
+#include "metrics.h"
+
+// three copies of a value: the one being written, the one being read and
+// the last published one in between, exchanged with one atomic operation
+template <class T>
+class TripleBuffer {
+  public:
+    TripleBuffer() : back(0), front(1), middle(2) {}
+
+    void init(const T & value) {
+        for (int i=0; i<3; i++)
+            buffers[i] = value;
+        back = 0;
+        front = 1;
+        middle = 2;
+    }
+
+    // producer side
+    T & write_buffer() { return buffers[back]; }
+    void publish() { back = middle.exchange(back | FRESH) & INDEX; }
+    // true when the last published copy has been taken
+    bool consumed() const { return !(middle.load() & FRESH); }
+
+    // consumer side, false when nothing was published since the last call
+    bool acquire() {
+        if (consumed())
+            return false;
+        front = middle.exchange(front) & INDEX;
+        return true;
+    }
+    const T & read_buffer() const { return buffers[front]; }
+
+  private:
+    static const int INDEX = 3;
+    static const int FRESH = 4; // set in middle when it wasn't read yet
+    T buffers[3];
+    int back;
+    int front;
+    std::atomic<int> middle;
+};
+
+class SimulationThread {
+  public:
+    SimulationThread() : grid(0), stepsPerFrame(1), fps(30), running(false),
+                         stepTime(0), publishTime(0), stepCount(0), dropped(0) {}
+    ~SimulationThread() { stop(); }
+
+    // step advances the grid, stepsPerFrame steps are computed for each
+    // frame of 1/fps s, or as many as possible when it is 0
+    // the steps and the snapshots are measured in metrics if given
+    void start(Grid & g, std::function<void()> s, int perFrame, int f,
+               Metrics * metrics=0) {
+        grid = &g;
+        step = s;
+        stepsPerFrame = perFrame;
+        fps = f;
+        if (metrics) {
+            stepTime = &metrics->histogram("step");
+            publishTime = &metrics->histogram("snapshot");
+            stepCount = &metrics->counter("steps");
+            dropped = &metrics->counter("dropped_snapshots");
+        }
+        snapshots.init(g);
+        running = true;
+        worker = std::thread(&SimulationThread::run, this);
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // the grid to draw, from the display thread
+    const Grid & snapshot() {
+        snapshots.acquire();
+        return snapshots.read_buffer();
+    }
+
+  private:
+    Grid * grid;
+    std::function<void()> step;
+    int stepsPerFrame;
+    int fps;
+    std::atomic<bool> running;
+    TripleBuffer<Grid> snapshots;
+    std::thread worker;
+    Histogram * stepTime;
+    Histogram * publishTime;
+    Counter * stepCount;
+    Counter * dropped; // published but replaced before being drawn
+
+    void timed_step() {
+        {
+            ScopedTimer timer(stepTime);
+            step();
+        }
+        if (stepCount)
+            stepCount->add();
+    }
+
+    void publish() {
+        ScopedTimer timer(publishTime);
+        if (dropped && !snapshots.consumed())
+            dropped->add();
+        snapshots.write_buffer().copy_cells(*grid);
+        snapshots.publish();
+    }
+
+    void run() {
+        std::chrono::microseconds frame(1000000 / fps);
+        auto next(std::chrono::steady_clock::now() + frame);
+        while (running) {
+            if (stepsPerFrame == 0) {
+                timed_step();
+                // only copied once the display took the previous one
+                if (snapshots.consumed())
+                    publish();
+                continue;
+            }
+            for (int i=0; i<stepsPerFrame && running; i++)
+                timed_step();
+            publish();
+            std::this_thread::sleep_until(next);
+            // a late frame is not caught up
+            next = std::max(next, std::chrono::steady_clock::now()) + frame;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,48 @@
+/*
+
+Geometric skip sampling: tells which cells succeed with a probability p
+while drawing one random number per success instead of one per cell
+
+*/
+
+#ifndef FORESTFIRE_SKIP_SAMPLER_H
+#define FORESTFIRE_SKIP_SAMPLER_H
+
+#include <cmath>
+
+class SkipSampler {
+  public:
+    SkipSampler(double p) : logq(std::log1p(-p)), left(-1) {}
+
+    // to call once for each eligible cell, in any order
+    template <class URNG>
+    bool hit(URNG & gen) {
+        if (left < 0) // first use, drawn here so that the seed can come later
+            left = gap(gen);
+        if (left > 0) {
+            left--;
+            return false;
+        }
+        left = gap(gen);
+        return true;
+    }
+
+    // cells left to skip, to save and restore a run (-1 before the first use)
+    long long remaining() const { return left; }
+    void restore(long long l) { left = l; }
+
+  private:
+    double logq; // log(1-p)
+    long long left;
+
+    template <class URNG>
+    long long gap(URNG & gen) {
+        // geometric distribution: floor(log(u) / log(1-p)) with 0 < u <= 1
+        double u((gen() - gen.min() + 1.0) / (gen.max() - gen.min() + 1.0));
+        if (logq == -INFINITY) // p == 1
+            return 0;
+        return (long long)(std::log(u) / logq);
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+
+Sparse square grid for huge percolation domains: the cells are stored in
+64x64 tiles that are allocated and filled with trees only when a cell of
+the tile is first read. The trees of a tile are a Philox function of
+(seed, tile, cell), so they don't depend on the order the tiles are
+reached in and a tile that is never read costs 4 bytes of index.
+
+*/
+
+#ifndef FORESTFIRE_SPARSE_GRID_H
+#define FORESTFIRE_SPARSE_GRID_H
+
+#include <cstdint>
+#include <vector>
+
+#include "lattice.h"
+#include "philox.h"
+
+#define TILE_BITS 6
+#define TILE_SIZE (1 << TILE_BITS)
+#define TILE_CELLS (TILE_SIZE * TILE_SIZE)
+#define CHUNK_TILES 256 // tiles allocated at a time (1 MB)
+
+class SparseGrid {
+  public:
+    long long rows;
+    long long cols;
+    // trees and cells generated inside the border (the border can't burn)
+    long long generatedTrees;
+    long long generatedCells;
+
+    SparseGrid() : rows(0), cols(0), generatedTrees(0), generatedCells(0),
+                   tileCols(0), seed(0), limit(0) {}
+
+    // the chunks are kept from one grid to the next, only the tiles that
+    // were used are forgotten
+    void init(long long r, long long c, double density, uint64_t s) {
+        long long tileRows((r + TILE_SIZE - 1) >> TILE_BITS);
+        long long tc((c + TILE_SIZE - 1) >> TILE_BITS);
+        if (rows != r || cols != c)
+            index.assign(tileRows * tc, 0);
+        else
+            for (std::size_t t : used)
+                index[t] = 0;
+        used.clear();
+        rows = r;
+        cols = c;
+        tileCols = tc;
+        seed = s;
+        limit = density * 4294967296.0;
+        generatedTrees = generatedCells = 0;
+    }
+
+    std::size_t tiles() const { return used.size(); }
+
+    // generates the tile of the cell the first time
+    uint8_t & cell(long long r, long long c) {
+        std::size_t t((r >> TILE_BITS) * tileCols + (c >> TILE_BITS));
+        if (index[t] == 0)
+            generate(t);
+        return tile(index[t])[(r & (TILE_SIZE-1)) * TILE_SIZE + (c & (TILE_SIZE-1))];
+    }
+
+  private:
+    long long tileCols;
+    uint64_t seed;
+    uint64_t limit; // a cell is a tree when its number is below
+    std::vector<uint32_t> index; // slot of each tile, 0 if not generated
+    std::vector<std::size_t> used; // tiles generated, in order
+    std::vector<std::vector<uint8_t> > chunks;
+
+    uint8_t * tile(uint32_t slot) {
+        slot--;
+        return &chunks[slot / CHUNK_TILES][(std::size_t)(slot % CHUNK_TILES) * TILE_CELLS];
+    }
+
+    void generate(std::size_t t) {
+        used.push_back(t);
+        uint32_t slot(used.size());
+        if ((slot - 1) / CHUNK_TILES >= chunks.size())
+            chunks.push_back(std::vector<uint8_t>((std::size_t)CHUNK_TILES * TILE_CELLS));
+        index[t] = slot;
+        uint8_t * cells(tile(slot));
+        long long top((t / tileCols) << TILE_BITS);
+        long long left((t % tileCols) << TILE_BITS);
+        uint32_t random[TILE_SIZE];
+        for (int i=0; i<TILE_SIZE; i++) {
+            row_random(seed, t, i * TILE_SIZE, TILE_SIZE, TREE_STREAM, random);
+            long long r(top + i);
+            for (int j=0; j<TILE_SIZE; j++) {
+                long long c(left + j);
+                bool inside(r < rows && c < cols);
+                uint8_t & state(cells[i * TILE_SIZE + j]);
+                state = inside && random[j] < limit ? TREE : EMPTY;
+                if (inside && r > 0 && r < rows-1 && c > 0 && c < cols-1) {
+                    generatedCells++;
+                    generatedTrees += state == TREE;
+                }
+            }
+        }
+    }
+};
+
+#endif
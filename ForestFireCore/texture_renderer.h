@@ -0,0 +1,89 @@
+/*
+
+Draws a square grid as one texture: the states go through a color lookup
+table into a pixel buffer uploaded once per frame and drawn as one quad
+
+*/
+
+#ifndef FORESTFIRE_TEXTURE_RENDERER_H
+#define FORESTFIRE_TEXTURE_RENDERER_H
+
+#include <GL/gl.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "lattice.h"
+
+class TextureRenderer {
+  public:
+    TextureRenderer() : texture(0), rows(0), cols(0) {}
+
+    // to call once the window exists, colors are {empty, tree, fire}
+    void init(int r, int c, const float colors[3][3], int persistance) {
+        rows = r;
+        cols = c;
+        // a fire fades to white while it burns, like with the rectangles
+        for (int s=0; s<256; s++) {
+            float rgb[3] = {0.0f, 0.0f, 0.0f};
+            if (s < FIRE) {
+                for (int i=0; i<3; i++)
+                    rgb[i] = colors[s][i];
+            }
+            else if (s <= FIRE + persistance) {
+                // 0 for a new fire, 1 for its last step
+                float fade(persistance ? 1.0f - (float)(s - FIRE) / persistance : 0.0f);
+                for (int i=0; i<3; i++)
+                    rgb[i] = colors[FIRE][i] + (1.0f - colors[FIRE][i]) * fade;
+            }
+            for (int i=0; i<3; i++)
+                lut[s][i] = (uint8_t)(rgb[i] * 255.0f + 0.5f);
+        }
+        pixels.assign((std::size_t)rows * cols * 3, 0);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cols, rows, 0, GL_RGB,
+                     GL_UNSIGNED_BYTE, &pixels[0]);
+    }
+
+    // the grid fills the whole viewport (-1 < X < 1 and -1 < Y < 1), the
+    // first row at the top
+    void draw(const Grid & grid) {
+        uint8_t * p(&pixels[0]);
+        for (int r=0; r<rows; r++) {
+            const uint8_t * row(grid[r]);
+            for (int c=0; c<cols; c++, p += 3) {
+                const uint8_t * color(lut[row[c]]);
+                p[0] = color[0];
+                p[1] = color[1];
+                p[2] = color[2];
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cols, rows, GL_RGB,
+                        GL_UNSIGNED_BYTE, &pixels[0]);
+        glEnable(GL_TEXTURE_2D);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+        glBegin(GL_QUADS);
+          glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, -1.0f);
+          glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0f, -1.0f);
+          glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0f, 1.0f);
+          glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, 1.0f);
+        glEnd();
+        glDisable(GL_TEXTURE_2D);
+    }
+
+  private:
+    GLuint texture;
+    int rows;
+    int cols;
+    uint8_t lut[256][3]; // color of each state
+    std::vector<uint8_t> pixels; // RGB, first row first
+};
+
+#endif
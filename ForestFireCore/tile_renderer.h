@@ -0,0 +1,99 @@
+/*
+
+Draws a tiling (hexagons, triangles) from vertex buffers: the geometry is
+uploaded once and only the colors of the cells that changed are updated,
+the whole grid is then drawn with one call
+
+The scripts must define GL_GLEXT_PROTOTYPES before including the GL headers
+
+*/
+
+#ifndef FORESTFIRE_TILE_RENDERER_H
+#define FORESTFIRE_TILE_RENDERER_H
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "lattice.h"
+
+class TileRenderer {
+  public:
+    TileRenderer() : rows(0), cols(0), verticesPerCell(0) {}
+
+    // to call once the window exists
+    // vertices: {x, y} of the triangles of each cell, the cells row by row
+    // colors: {empty, tree, fire}, every fire state has the fire color
+    void init(int r, int c, int perCell, const std::vector<float> & vertices,
+              const float colors[3][3]) {
+        rows = r;
+        cols = c;
+        verticesPerCell = perCell;
+        for (int s=0; s<256; s++)
+            for (int i=0; i<3; i++)
+                lut[s][i] = (uint8_t)(colors[s < FIRE ? s : FIRE][i] * 255.0f + 0.5f);
+        drawn.assign((std::size_t)rows * cols, 255); // nothing drawn yet
+        cellColors.assign((std::size_t)rows * cols * verticesPerCell * 3, 0);
+        glGenBuffers(1, &vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                     &vertices[0], GL_STATIC_DRAW);
+        glGenBuffers(1, &colorBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+        glBufferData(GL_ARRAY_BUFFER, cellColors.size(), &cellColors[0],
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void draw(const Grid & grid) {
+        // only the range of the cells that changed is uploaded
+        int first(-1), last(-1);
+        int bytesPerCell(verticesPerCell * 3);
+        for (int r=0; r<rows; r++) {
+            const uint8_t * row(grid[r]);
+            for (int c=0; c<cols; c++) {
+                int i(r*cols + c);
+                if (row[c] == drawn[i])
+                    continue;
+                drawn[i] = row[c];
+                uint8_t * p(&cellColors[(std::size_t)i * bytesPerCell]);
+                for (int v=0; v<verticesPerCell; v++, p += 3) {
+                    p[0] = lut[row[c]][0];
+                    p[1] = lut[row[c]][1];
+                    p[2] = lut[row[c]][2];
+                }
+                if (first < 0)
+                    first = i;
+                last = i;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+        if (first >= 0)
+            glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)first * bytesPerCell,
+                            (GLsizeiptr)(last - first + 1) * bytesPerCell,
+                            &cellColors[(std::size_t)first * bytesPerCell]);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glVertexPointer(2, GL_FLOAT, 0, 0);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glDrawArrays(GL_TRIANGLES, 0, rows * cols * verticesPerCell);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+  private:
+    int rows;
+    int cols;
+    int verticesPerCell;
+    GLuint vertexBuffer;
+    GLuint colorBuffer;
+    uint8_t lut[256][3]; // color of each state
+    std::vector<uint8_t> drawn; // state of each cell in the color buffer
+    std::vector<uint8_t> cellColors; // RGB of each vertex
+};
+
+#endif
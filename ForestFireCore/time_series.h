@@ -0,0 +1,121 @@
+/*
+
+Time series of the observables: one row per step kept in a preallocated
+ring of rows, appended to a csv file each time the ring is full and when
+it is closed
+
+*/
+
+#ifndef FORESTFIRE_TIME_SERIES_H
+#define FORESTFIRE_TIME_SERIES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "lattice.h"
+
+class TimeSeries {
+  public:
+    TimeSeries() : file(0), cells(0), first(0), count(0) {}
+    ~TimeSeries() { close(); }
+
+    // cells: size of the grid, to get the empty cells
+    bool open(const std::string & path, long long c, std::size_t capacity=4096) {
+        file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            std::cerr << "can't write " << path << std::endl;
+            return false;
+        }
+        std::fprintf(file, "step,empty,trees,fires,burned_area,grown,struck,lit,burnt_out,perimeter\n");
+        start(c, capacity);
+        return true;
+    }
+
+    // continues the file of a resumed run at the given step: the rows
+    // after it, written before the run stopped, are cut so that no step
+    // is there twice
+    bool resume(const std::string & path, long long c, uint64_t step,
+                std::size_t capacity=4096) {
+        std::FILE * in(std::fopen(path.c_str(), "r"));
+        if (!in)
+            return open(path, c, capacity);
+        long kept(0); // bytes of the header and of the complete rows kept
+        bool header(true);
+        char line[512];
+        while (std::fgets(line, sizeof line, in)) {
+            if (!std::strchr(line, '\n'))
+                break; // cut while it was written
+            if (!header && std::strtoull(line, 0, 10) > step)
+                break;
+            header = false;
+            kept = std::ftell(in);
+        }
+        std::fclose(in);
+        if (kept == 0)
+            return open(path, c, capacity);
+        if (truncate(path.c_str(), kept) != 0
+            || !(file = std::fopen(path.c_str(), "a"))) {
+            std::cerr << "can't append to " << path << std::endl;
+            return false;
+        }
+        start(c, capacity);
+        return true;
+    }
+
+    void record(uint64_t step, const Observables & observables) {
+        if (!file)
+            return;
+        Row & row(ring[(first + count) % ring.size()]);
+        row.step = step;
+        row.observables = observables;
+        if (++count == ring.size())
+            flush();
+    }
+
+    void flush() {
+        for (; count > 0; count--, first = (first + 1) % ring.size()) {
+            const Row & row(ring[first]);
+            const Observables & o(row.observables);
+            std::fprintf(file, "%llu,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                         (unsigned long long)row.step, cells - o.trees - o.fires,
+                         o.trees, o.fires, o.burnedArea, o.grown, o.struck,
+                         o.lit, o.burntOut, o.perimeter);
+        }
+        std::fflush(file);
+    }
+
+    void close() {
+        if (!file)
+            return;
+        flush();
+        std::fclose(file);
+        file = 0;
+    }
+
+  private:
+    struct Row {
+        uint64_t step;
+        Observables observables;
+    };
+
+    std::FILE * file;
+    long long cells;
+    std::vector<Row> ring;
+    std::size_t first; // oldest row not written
+    std::size_t count;
+
+    void start(long long c, std::size_t capacity) {
+        cells = c;
+        ring.assign(capacity, Row());
+        first = count = 0;
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@ Forest fire simulation with hexagonal tiling
 
 */
 
+#define GL_GLEXT_PROTOTYPES // vertex buffers
 #include <GL/gl.h>
 #include <GL/glut.h>
 
@@ -14,25 +15,57 @@ Forest fire simulation with hexagonal tiling
 #include <random>
 #include <ctime>
 #include <vector>
+#include <string>
+
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/tile_renderer.h"
+#include "../ForestFireCore/sim_thread.h"
+#include "../ForestFireCore/metrics.h"
+#include "../ForestFireCore/recorder.h"
+#include "../ForestFireCore/replay.h"
+#include "../ForestFireCore/time_series.h"
+#include "../ForestFireCore/band_pool.h"
 
-#define EMPTY 0
-#define TREE 1
-#define FIRE 2
-#define NEW_EMPTY 3 // empty for the next round
-#define NEW_TREE 4 // tree for the next round
-#define NEW_FIRE 5 // fire for the next round
 #define P 100 // new tree probability 1/p
 #define F 1000 // fire probability 1/f
+#define RNG SKIP_SAMPLING // STD_RAND, SKIP_SAMPLING or COUNTER
+#define SEED 0 // 0 to seed from the time
+#define THREADS 1 // threads stepping bands of rows, 0 for all the cores
+#if THREADS != 1 && RNG != COUNTER
+#error "the threads need the random numbers of RNG COUNTER"
+#endif
+#define BOUNDARY FIXED // FIXED or PERIODIC (needs an even amount of rows)
+#define IMMEDIATE 0 // one polygon per cell
+#define VERTEX_BUFFER 1 // the hexagons are built once, one draw call
+#define RENDERER VERTEX_BUFFER
 
 #define ROWS 60
 #define COLUMNS 80
 #define CELL_SIZE 10
 #define FPS 10
+#define STEPS_PER_FRAME 1 // steps drawn per frame, 0 to step as fast as possible
+#define METRICS_TITLE 0 // 1 to show the metrics in the window title
+#define RECORD_EVERY 0 // records every Nth step to RECORD_FILE, 0 not to record
+#define RECORD_FILE "Forest_fire_hexa.ffr"
+#define KEYFRAME_INTERVAL 100 // recorded frames between two full grids
+#define TIME_SERIES 0 // 1 to write the populations of each step to TIME_SERIES_FILE
+#define TIME_SERIES_FILE "Populations_hexa.csv"
 
-int ** grid = nullptr;
-
-std::vector<std::vector<int>> neighbors1 = {{-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, 0},  {1, 1}};
-std::vector<std::vector<int>> neighbors2 = {{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, -1},  {1, 0}};
+Grid grid;
+RandomEvents randomEvents(RNG, P, F);
+Rules rules = {0, ROWS};
+Observables observables; // updated by the steps
+TileRenderer renderer;
+Metrics metrics; // written to Metrics_hexa.csv/json on exit and on SIGUSR1
+Histogram & frameTime(metrics.histogram("frame"));
+Histogram & drawTime(metrics.histogram("draw"));
+Histogram & swapTime(metrics.histogram("swap"));
+Counter & frames(metrics.counter("frames"));
+TimeSeries timeSeries;
+Recorder recorder;
+Replay replay; // --replay FILE plays a recording instead of simulating
+BandPool bands; // steps the rows on THREADS threads
+SimulationThread simulation; // after what the steps use
 
 float cos30(std::cos(30.0 * 3.14159 / 180.0));
 float sin30(std::sin(30.0 * 3.14159 / 180.0));
@@ -54,31 +87,57 @@ void timer_callback(int);
 void display_callback();
 void reshape_callback(int width, int height);
 void draw_hexagonv();
-void draw_grid();
+void draw_grid(const Grid & cells);
 
-void draw_hexagonv(int row, int col) {
+void hexagon_corners(int row, int col, float corners[6][2]) {
     float x(col+0.5);
     float y(row+0.25);
     float xCorr((row%2) ? 0.0 : 0.5);
     float yCorr(row * (1.0-cos30) + 0.5);
     x -= xCorr;
     y -= yCorr;
+    float xs[6] = {x, x + hexaSideX, x + hexaSideX, x, x - hexaSideX, x - hexaSideX};
+    float ys[6] = {y, y + hexaSideY, y + hexaSideY2, y + hexaSide * (2*sin30 + 1),
+                   y + hexaSideY2, y + hexaSideY};
+    for (int i=0; i<6; i++) {
+        corners[i][0] = xs[i];
+        corners[i][1] = ys[i];
+    }
+}
+
+void draw_hexagonv(int row, int col) {
+    float corners[6][2];
+    hexagon_corners(row, col, corners);
     glBegin(GL_POLYGON);
-      glVertex2f(x, y);
-      glVertex2f(x + hexaSideX, y + hexaSideY);
-      glVertex2f(x + hexaSideX, y + hexaSideY2);
-      glVertex2f(x, y + hexaSide * (2*sin30 + 1));
-      glVertex2f(x - hexaSideX, y + hexaSideY2);
-      //glColor3f(0.0, 0.0, 0.0);
-      glVertex2f(x - hexaSideX, y + hexaSideY);
+    for (int i=0; i<6; i++)
+        glVertex2f(corners[i][0], corners[i][1]);
     glEnd();
 }
 
-void draw_grid() {
+std::vector<float> hexagon_triangles() {
+    // 4 triangles per hexagon, fanned from its first corner
+    std::vector<float> res;
+    float corners[6][2];
+    for (int r=0; r<ROWS; r++) {
+        for (int c=0; c<COLUMNS; c++) {
+            hexagon_corners(r, c, corners);
+            for (int t=1; t<5; t++) {
+                int fan[3] = {0, t, t+1};
+                for (int i : fan) {
+                    res.push_back(corners[i][0]);
+                    res.push_back(corners[i][1]);
+                }
+            }
+        }
+    }
+    return res;
+}
+
+void draw_grid(const Grid & cells) {
     int temp;
     for (int r=0; r<ROWS; r++) {
         for (int c=0; c<COLUMNS; c++) {
-            temp = grid[r][c];
+            temp = cells[r][c];
             if (temp == EMPTY)
                 continue;
             else if (temp==FIRE)
@@ -92,100 +151,61 @@ void draw_grid() {
 }
 
 void init_grid() {
-    grid = new int * [ROWS];
-    for (int i=0; i<ROWS; i++) {
-        grid[i] = new int [COLUMNS];
-        for (int j=0; j<COLUMNS; j++) {
-            grid[i][j] = EMPTY;
-        }
-    }
-}
-
-void new_tree(int row, int col) {
-    if (rand()%P == 0) {
-        grid[row][col] = NEW_TREE;
-    }
-}
-
-void new_fire(int row, int col) {
-    if (rand()%F == 0) {
-        grid[row][col] = NEW_FIRE;
-        return;
-    }
-}
-
-void fire_around(int row, int col) {
-    int newR, newC;
-    int temp;
-    std::vector<std::vector<int>> N;
-    if (row%2)
-        N = neighbors1;
-    else
-        N = neighbors2;
-    for (std::vector<int> v : N) {
-        newR = row + v[0];
-        if (newR < 0 || newR >= ROWS) // check if out of grid
-            continue;
-        newC = col + v[1];
-        if (newC < 0 || newC >= COLUMNS) // check if out of grid
-            continue;
-        temp = grid[newR][newC];
-        // if fire or old fire or (older fire but not just created)
-        if (temp == TREE) {
-            grid[newR][newC] = NEW_FIRE;
-        }
-    }
+    grid.init(ROWS, COLUMNS, EMPTY, BOUNDARY);
 }
 
 void next_step() {
     //write();
-    // temporary states
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == EMPTY)
-                new_tree(r, c);
-            else if (grid[r][c] == TREE)
-                new_fire(r, c);
-            else if (grid[r][c] == FIRE) {
-                grid[r][c] = NEW_EMPTY;
-                fire_around(r, c);
-            }
-        }
-    }
-    // temporary states to definitive state
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] < 6)
-                grid[r][c] %= 3;
-        }
-    }
+    // each tree looks for a fire around it in the previous state
+    ds_step_bands<Hexagonal>(grid, rules, randomEvents, bands, &observables);
+    timeSeries.record(randomEvents.step, observables);
+    recorder.record(grid, randomEvents.step);
 }
 
 void stats() {
-    int fireCount(0), treeCount(0);
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == TREE)
-                treeCount++;
-            if (grid[r][c] == FIRE)
-                fireCount++;
-        }
-    }
-    std::cout << treeCount << "\t" << fireCount << std::endl;
+    std::cout << observables.trees << "\t" << observables.fires << std::endl;
 }
 
 void init() {
     glClearColor(colors[EMPTY][0], colors[EMPTY][1], colors[EMPTY][2], 0.0f);
-    std::srand(std::time(0));
+    randomEvents.set_seed((SEED != 0) ? SEED : std::time(0));
+    std::cout << "seed " << randomEvents.seed << std::endl;
     init_grid();
+    if (RENDERER == VERTEX_BUFFER)
+        renderer.init(ROWS, COLUMNS, 12, hexagon_triangles(), colors);
+    if (replay.is_open()) { // nothing to simulate
+        replay.show(grid);
+        return;
+    }
+    observables.count(grid);
+    if (TIME_SERIES)
+        timeSeries.open(TIME_SERIES_FILE, (long long)ROWS * COLUMNS);
+    if (RECORD_EVERY) {
+        recorder.open(RECORD_FILE, ROWS, COLUMNS, RECORD_EVERY, KEYFRAME_INTERVAL,
+                      randomEvents.seed);
+        recorder.record(grid, 0);
+    }
+    bands.start(THREADS);
+    simulation.start(grid, next_step, STEPS_PER_FRAME, FPS, &metrics);
 }
 
 void display_callback() {
+    ScopedTimer frameTimer(&frameTime);
+    const Grid & shown(replay.is_open() ? grid : simulation.snapshot());
     glClear (GL_COLOR_BUFFER_BIT);
-
-    draw_grid();
-    glFlush();
-    glutSwapBuffers();
+    {
+        ScopedTimer drawTimer(&drawTime);
+        if (RENDERER == VERTEX_BUFFER)
+            renderer.draw(shown);
+        else
+            draw_grid(shown);
+    }
+    {
+        ScopedTimer swapTimer(&swapTime);
+        glFlush();
+        glutSwapBuffers();
+    }
+    frames.add();
 }
 
 void reshape_callback(int width, int height) {
@@ -196,29 +216,62 @@ void reshape_callback(int width, int height) {
     glMatrixMode(GL_MODELVIEW);
 }
 
-void timer_callback(int) {
-    auto start(std::chrono::steady_clock::now());
+void dump_metrics() {
+    metrics.dump("Metrics_hexa");
+}
 
-    next_step();
-    //stats();
-    glutPostRedisplay(); // run the display_callback function
+bool open_replay(const char * path) {
+    if (!replay.open(path))
+        return false;
+    if (replay.rows != ROWS || replay.cols != COLUMNS) {
+        std::cerr << "the recording is " << replay.rows << "x" << replay.cols
+                  << ", not " << ROWS << "x" << COLUMNS << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    auto stop(std::chrono::steady_clock::now());
-    auto duration(std::chrono::duration_cast<std::chrono::milliseconds>(stop-start));
-    glutTimerFunc(std::abs(1000.0/FPS - duration.count()), timer_callback, 0);
+void show_replay() {
+    replay.show(grid);
+    std::string title("step " + std::to_string(replay.step()));
+    glutSetWindowTitle(title.c_str());
+}
+
+// space: pause, r: reverse, +/-: speed, ./,: one frame, 0-9: seek
+void keyboard_callback(unsigned char key, int, int) {
+    if (replay.is_open() && replay.key(key))
+        show_replay();
+}
+
+void timer_callback(int) {
+    // the steps are done by the simulation thread
+    static int ticks(0);
+    if (replay.is_open() && replay.tick())
+        show_replay();
+    if (Metrics::dump_requested())
+        dump_metrics();
+    if (METRICS_TITLE && ++ticks % FPS == 0)
+        glutSetWindowTitle(metrics.overlay().c_str());
+    glutPostRedisplay(); // run the display_callback function
+    glutTimerFunc(1000/FPS, timer_callback, 0);
 }
 
 
 int main(int argc, char **argv) {
     glutInit(&argc, argv); // initialize
+    if (argc > 2 && std::string(argv[1]) == "--replay" && !open_replay(argv[2]))
+        return 1;
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
     glutInitWindowPosition(15, 15); // optional
     glutInitWindowSize(COLUMNS*CELL_SIZE, ROWS*CELL_SIZE);
     glutCreateWindow("Forest fire simulation with hexagonal tiling");
     glutDisplayFunc(display_callback);
     glutReshapeFunc(reshape_callback);
+    glutKeyboardFunc(keyboard_callback);
     glutTimerFunc(1000/FPS, timer_callback, 0);
     init();
+    Metrics::dump_on_signal(SIGUSR1);
+    std::atexit(dump_metrics);
     glutMainLoop();
 
     return 0;
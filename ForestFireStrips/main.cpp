@@ -0,0 +1,192 @@
+/*
+
+Drossel-Schwabl forest fire split over several processes, without a window
+
+The rows are split into strips, one per process, and the processes only
+hold their own strip. Before each step the rows next to the strips (two
+for the triangular tiling with 12 neighbors) are exchanged through shared
+memory (halo_exchange.h). The random numbers are COUNTER ones of the
+whole grid, so the run is the same whatever the amount of processes.
+
+The processes are forked by a local launcher. The first one gathers the
+populations of every step (TIME_SERIES) and the recorded frames.
+
+Usage: Forest_fire_strips [processes] [steps]
+
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/halo_exchange.h"
+#include "../ForestFireCore/recorder.h"
+#include "../ForestFireCore/time_series.h"
+
+#define P 100 // new tree probability 1/p
+#define F 1000 // new fire probability 1/f
+#define SEED 1 // the same run for any amount of processes
+#define FIRE_PERSISTANCE 0
+#define STENCIL Moore // VonNeumann, Moore, Hexagonal, TriangularSide or TriangularAll
+#define ROWS 2000
+#define COLUMNS 2000
+#define PROCESSES 4 // default amount of strips
+#define STEPS 1000 // default amount of steps
+#define RECORD_EVERY 0 // records every Nth step to RECORD_FILE, 0 not to record
+#define RECORD_FILE "Forest_fire_strips.ffr"
+#define KEYFRAME_INTERVAL 100 // recorded frames between two full grids
+#define TIME_SERIES 1 // 1 to write the populations of each step to TIME_SERIES_FILE
+#define TIME_SERIES_FILE "Populations_strips.csv"
+
+HaloExchange exchange;
+// of the process
+int strip;
+Grid grid;
+RandomEvents randomEvents(COUNTER, P, F);
+Rules rules = {FIRE_PERSISTANCE, 0};
+Observables observables; // of the strip, updated by the steps
+// of the first process
+TimeSeries timeSeries;
+Recorder recorder;
+Grid gathered; // whole grid of the recorded frames
+
+// rows the stencil reaches above and below a cell
+template <class Stencil>
+int halo_rows() {
+    int reach(0);
+    for (int p=0; p<Stencil::parities; p++)
+        for (int n=0; n<Stencil::size; n++)
+            reach = std::max(reach, std::abs(Stencil::offsets(p)[n][0]));
+    return reach;
+}
+
+// the strips have an even amount of rows so that the parities of the
+// hexagonal and triangular cells are the ones of the whole grid
+std::vector<int> first_rows(int processes) {
+    int height(ROWS / processes / 2 * 2);
+    std::vector<int> first;
+    for (int s=0; s<processes; s++)
+        first.push_back(s * height);
+    return first;
+}
+
+bool recorded(uint64_t step) {
+#if RECORD_EVERY
+    return step % RECORD_EVERY == 0;
+#else
+    (void)step;
+    return false;
+#endif
+}
+
+// by the first process once every strip has put the step
+void gather(uint64_t step) {
+    if (TIME_SERIES && step > 0)
+        timeSeries.record(step, exchange.gather_populations(step));
+    if (recorded(step)) {
+        exchange.gather_frame(gathered, step);
+        recorder.record(gathered, step);
+    }
+}
+
+void put(uint64_t step) {
+    exchange.put_populations(strip, step, observables);
+    if (recorded(step))
+        exchange.put_frame(strip, grid, step);
+}
+
+void run_strip(int s, int steps) {
+    strip = s;
+    int rows(exchange.strip_rows(strip));
+    grid.init(rows, COLUMNS);
+    rules.steppedRows = rows;
+    randomEvents.set_seed(SEED);
+    randomEvents.firstCell = exchange.first_row(strip) * COLUMNS;
+    observables.count(grid);
+    if (strip == 0) {
+        if (TIME_SERIES)
+            timeSeries.open(TIME_SERIES_FILE, (long long)ROWS * COLUMNS);
+        if (RECORD_EVERY) {
+            gathered.init(ROWS, COLUMNS);
+            recorder.open(RECORD_FILE, ROWS, COLUMNS, RECORD_EVERY,
+                          KEYFRAME_INTERVAL, SEED);
+        }
+    }
+    put(0);
+    for (int step=1; step<=steps; step++) {
+        exchange.publish(strip, grid, step);
+        exchange.wait();
+        if (strip == 0)
+            gather(step - 1);
+        exchange.receive(strip, grid, step);
+        ds_step<STENCIL>(grid, rules, randomEvents, &observables);
+        put(step);
+    }
+    exchange.wait();
+    if (strip == 0) {
+        gather(steps);
+        Observables total(exchange.gather_populations(steps));
+        std::cout << "trees " << total.trees << ", fires " << total.fires
+                  << ", burned area " << total.burnedArea << std::endl;
+        timeSeries.close();
+        recorder.close();
+    }
+}
+
+int main(int argc, char **argv) {
+    int processes(argc > 1 ? std::atoi(argv[1]) : PROCESSES);
+    int steps(argc > 2 ? std::atoi(argv[2]) : STEPS);
+    int halo(halo_rows<STENCIL>());
+    if (processes < 1 || ROWS / processes / 2 * 2 < halo) {
+        std::cerr << "the strips must have at least " << halo << " rows" << std::endl;
+        return 1;
+    }
+    if (!exchange.open(first_rows(processes), ROWS, COLUMNS, halo, RECORD_EVERY != 0))
+        return 1;
+    std::cout << ROWS << "x" << COLUMNS << " in " << processes << " strips, "
+              << halo << " halo rows, seed " << SEED << std::endl;
+    auto start(std::chrono::steady_clock::now());
+    std::vector<pid_t> children;
+    for (int s=0; s<processes; s++) {
+        pid_t pid(fork());
+        if (pid == 0) {
+            run_strip(s, steps);
+            std::exit(0);
+        }
+        if (pid < 0) {
+            std::cerr << "can't fork" << std::endl;
+            break;
+        }
+        children.push_back(pid);
+    }
+    // the others would wait forever at the barrier if one of them fails
+    bool ok((int)children.size() == processes);
+    if (!ok)
+        for (pid_t child : children)
+            kill(child, SIGTERM);
+    for (std::size_t ended=0; ended<children.size(); ended++) {
+        int status;
+        pid_t pid(wait(&status));
+        if (ok && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            std::cerr << "process " << pid << " failed" << std::endl;
+            ok = false;
+            for (pid_t child : children)
+                kill(child, SIGTERM);
+        }
+    }
+    exchange.close();
+    std::chrono::duration<double> duration(std::chrono::steady_clock::now() - start);
+    if (ok)
+        std::cout << steps << " steps in " << duration.count() << " s, "
+                  << (double)ROWS * COLUMNS * steps / duration.count() / 1e6
+                  << " Mcells/s" << std::endl;
+    return ok ? 0 : 1;
+}
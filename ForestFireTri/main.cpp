@@ -4,6 +4,7 @@ Forest fire simulation with triangular tiling
 
 */
 
+#define GL_GLEXT_PROTOTYPES // vertex buffers
 #include <GL/gl.h>
 #include <GL/glut.h>
 
@@ -14,16 +15,30 @@ Forest fire simulation with triangular tiling
 #include <random>
 #include <chrono>
 #include <vector>
+#include <string>
+
+#include "../ForestFireCore/lattice.h"
+#include "../ForestFireCore/tile_renderer.h"
+#include "../ForestFireCore/sim_thread.h"
+#include "../ForestFireCore/metrics.h"
+#include "../ForestFireCore/recorder.h"
+#include "../ForestFireCore/replay.h"
+#include "../ForestFireCore/time_series.h"
+#include "../ForestFireCore/band_pool.h"
 
-#define EMPTY 0
-#define TREE 1
-#define FIRE 2
-#define NEW_EMPTY 3 // empty for the next round
-#define NEW_TREE 4 // tree for the next round
-#define NEW_FIRE 5 // fire for the next round
 #define P 100 // new tree probability 1/p
 #define F 1000 // new fire probability 1/f
+#define RNG SKIP_SAMPLING // STD_RAND, SKIP_SAMPLING or COUNTER
+#define SEED 0 // 0 to seed from the time
+#define THREADS 1 // threads stepping bands of rows, 0 for all the cores
+#if THREADS != 1 && RNG != COUNTER
+#error "the threads need the random numbers of RNG COUNTER"
+#endif
+#define BOUNDARY FIXED // FIXED or PERIODIC (needs even rows and columns)
 #define FIRE_PERSISTANCE 0
+#define IMMEDIATE 0 // one triangle call per cell
+#define VERTEX_BUFFER 1 // the triangles are built once, one draw call
+#define RENDERER VERTEX_BUFFER
 #define SIDE_NEIGHBORS 3 // when side touches
 #define ALL_NEIGHBORS 12 // when tip touches
 
@@ -33,17 +48,30 @@ Forest fire simulation with triangular tiling
 #define COLUMNS 200
 #define CELL_SIZE 4
 #define FPS 30
-
-int ** grid = nullptr;
+#define STEPS_PER_FRAME 1 // steps drawn per frame, 0 to step as fast as possible
+#define METRICS_TITLE 0 // 1 to show the metrics in the window title
+#define RECORD_EVERY 0 // records every Nth step to RECORD_FILE, 0 not to record
+#define RECORD_FILE "Forest_fire_tri.ffr"
+#define KEYFRAME_INTERVAL 100 // recorded frames between two full grids
+#define TIME_SERIES 0 // 1 to write the populations of each step to TIME_SERIES_FILE
+#define TIME_SERIES_FILE "Populations_tri.csv"
+
+Grid grid;
+RandomEvents randomEvents(RNG, P, F);
+Rules rules = {FIRE_PERSISTANCE, ROWS};
+Observables observables; // updated by the steps
 int neighborsAmount = 3;
-
-std::vector<std::vector<std::vector<int>>> neighbors;
-std::vector<std::vector<std::vector<int>>> sideNeighbors = {
-                                         {{0, -1}, {-1, 0}, {1, 0}}, // when row%2 == col%2
-                                         {{-1, 0}, {1, 0}, {0, 1}}}; // when row%2 != col%2
-std::vector<std::vector<std::vector<int>>> allNeighbors = {
-{{2, 0}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-2, 0}, {-2, -1}, {-1, -1}, {0, -1}, {1, -1}, {2, -1}},
- {{2, 1}, {1, 1}, {0, 1}, {-1, 1}, {-2, 1}, {-2, 0}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}, {1, 0}, {2, 0}}};
+TileRenderer renderer;
+Metrics metrics; // written to Metrics_tri.csv/json on exit and on SIGUSR1
+Histogram & frameTime(metrics.histogram("frame"));
+Histogram & drawTime(metrics.histogram("draw"));
+Histogram & swapTime(metrics.histogram("swap"));
+Counter & frames(metrics.counter("frames"));
+TimeSeries timeSeries;
+Recorder recorder;
+Replay replay; // --replay FILE plays a recording instead of simulating
+BandPool bands; // steps the rows on THREADS threads
+SimulationThread simulation; // after what the steps use
 
 float sin60(std::sin(60.0 * 3.14159 / 180.0));
 
@@ -58,41 +86,90 @@ void display_callback();
 void reshape_callback(int width, int height);
 void init_grid(int initialState);
 void init_neighbors(int neigh);
+std::vector<float> grid_triangles();
+void next_step();
 
 void init(int initialState, int neigh) {
     glClearColor(colors[EMPTY][0], colors[EMPTY][1], colors[EMPTY][2], 0.0f);
-    std::srand(std::time(0));
+    randomEvents.set_seed((SEED != 0) ? SEED : std::time(0));
+    std::cout << "seed " << randomEvents.seed << std::endl;
     init_grid(initialState);
     init_neighbors(neigh);
+    if (RENDERER == VERTEX_BUFFER)
+        renderer.init(ROWS, COLUMNS, 3, grid_triangles(), colors);
+    if (replay.is_open()) { // nothing to simulate
+        replay.show(grid);
+        return;
+    }
+    observables.count(grid);
+    if (TIME_SERIES)
+        timeSeries.open(TIME_SERIES_FILE, (long long)ROWS * COLUMNS);
+    if (RECORD_EVERY) {
+        recorder.open(RECORD_FILE, ROWS, COLUMNS, RECORD_EVERY, KEYFRAME_INTERVAL,
+                      randomEvents.seed);
+        recorder.record(grid, 0);
+    }
+    bands.start(THREADS);
+    simulation.start(grid, next_step, STEPS_PER_FRAME, FPS, &metrics);
 }
 
-void draw_triangle(int row, int col, bool right) {
+bool points_right(int row, int col) {
+    return (row%2 != 0) ? (col%2) : !(col%2);
+}
+
+void triangle_corners(int row, int col, bool right, float corners[3][2]) {
     float x(col);
     float y(row);
     y /= 2;
     if (right) {
-        glBegin(GL_TRIANGLES);
-          glVertex2f(x, y + 0.5);  // up
-          glVertex2f(x + 1, y);    // right
-          glVertex2f(x, y - 0.5);  // down
-        glEnd();
+        float xs[3] = {x, x + 1, x};          // up, right, down
+        float ys[3] = {y + 0.5f, y, y - 0.5f};
+        for (int i=0; i<3; i++) {
+            corners[i][0] = xs[i];
+            corners[i][1] = ys[i];
+        }
     }
     else {
-        glBegin(GL_TRIANGLES);
-          glVertex2f(x, y);           // left
-          glVertex2f(x + 1, y + 0.5); // up
-          glVertex2f(x + 1, y - 0.5); // down
-        glEnd();
+        float xs[3] = {x, x + 1, x + 1};      // left, up, down
+        float ys[3] = {y, y + 0.5f, y - 0.5f};
+        for (int i=0; i<3; i++) {
+            corners[i][0] = xs[i];
+            corners[i][1] = ys[i];
+        }
+    }
+}
+
+void draw_triangle(int row, int col, bool right) {
+    float corners[3][2];
+    triangle_corners(row, col, right, corners);
+    glBegin(GL_TRIANGLES);
+    for (int i=0; i<3; i++)
+        glVertex2f(corners[i][0], corners[i][1]);
+    glEnd();
+}
+
+std::vector<float> grid_triangles() {
+    std::vector<float> res;
+    float corners[3][2];
+    for (int r=0; r<ROWS; r++) {
+        for (int c=0; c<COLUMNS; c++) {
+            triangle_corners(r, c, points_right(r, c), corners);
+            for (int i=0; i<3; i++) {
+                res.push_back(corners[i][0]);
+                res.push_back(corners[i][1]);
+            }
+        }
     }
+    return res;
 }
 
-void draw_grid() {
+void draw_grid(const Grid & cells) {
     int temp;
     float ratio;
     for (int r=0; r<ROWS; r++) {
         //glColor3f(0.0, 0.0, 1.0);
         for (int c=0; c<COLUMNS; c++) {
-            temp = grid[r][c];
+            temp = cells[r][c];
             if (temp == FIRE) {
                 glColor3f(1.0, 0.0, 0.0);
             }
@@ -100,109 +177,55 @@ void draw_grid() {
                 glColor3f(colors[TREE][0], colors[TREE][1], colors[TREE][2]);
             if (temp == EMPTY)
                 continue;
-            draw_triangle(r, c, (r%2 != 0) ? (c%2) : !(c%2));
+            draw_triangle(r, c, points_right(r, c));
         }
     }
 }
 void init_grid(int initialState) {
-    grid = new int * [ROWS];
-    for (int i=0; i<ROWS; i++) {
-        grid[i] = new int [COLUMNS];
-        for (int j=0; j<COLUMNS; j++) {
-            grid[i][j] = initialState;
-        }
-    }
+    grid.init(ROWS, COLUMNS, initialState, BOUNDARY);
 }
 
 void init_neighbors(int type) {
     neighborsAmount = type;
-    if (type == SIDE_NEIGHBORS)
-        neighbors = sideNeighbors;
-    else
-        neighbors = allNeighbors;
-}
-
-void new_tree(int row, int col) {
-    if (rand()%P == 0) {
-        grid[row][col] = NEW_TREE;
-    }
-}
-
-void new_fire(int row, int col) {
-    // can randomly become a fire
-    if (rand()%F == 0) {
-        grid[row][col] = NEW_FIRE + FIRE_PERSISTANCE;
-        return;
-    }
-    // or put on fire if one is around
-    int newR, newC;
-    int temp;
-    for (int n=0; n<neighborsAmount; n++) {
-        newR = row + neighbors[row%2 != col%2][n][0];
-        if (newR < 0 || newR >= ROWS) // check if out of grid
-            continue;
-        newC = col + neighbors[row%2 != col%2][n][1];
-        if (newC < 0 || newC >= COLUMNS) // check if out of grid
-            continue;
-        temp = grid[newR][newC];
-        // if fire or old fire or (older fire but not just created)
-        if (temp == FIRE || temp == NEW_EMPTY ||
-            (temp > NEW_FIRE && temp != NEW_FIRE + FIRE_PERSISTANCE)) {
-            grid[row][col] = NEW_FIRE + FIRE_PERSISTANCE;
-            return;
-        }
-    }
 }
 
 void next_step() {
-    // temporary states
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == EMPTY)
-                new_tree(r, c);
-            else if (grid[r][c] == TREE)
-                new_fire(r, c);
-            else if (grid[r][c] == FIRE)
-                grid[r][c] = NEW_EMPTY;
-            else if (grid[r][c] > NEW_FIRE)
-                grid[r][c]--;
-        }
-    }
-    // temporary states to definitive state
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] < 6) // to avoid touching old fires with FIRE_PERSISTANCE
-                grid[r][c] %= 3;
-        }
-    }
+    if (neighborsAmount == SIDE_NEIGHBORS)
+        ds_step_bands<TriangularSide>(grid, rules, randomEvents, bands, &observables);
+    else
+        ds_step_bands<TriangularAll>(grid, rules, randomEvents, bands, &observables);
+    timeSeries.record(randomEvents.step, observables);
+    recorder.record(grid, randomEvents.step);
 }
 
 void stats() {
-    int fireCount(0), treeCount(0);
-    for (int r=0; r<ROWS; r++) {
-        for (int c=0; c<COLUMNS; c++) {
-            if (grid[r][c] == TREE)
-                treeCount++;
-            if (grid[r][c] == FIRE)
-                fireCount++;
-        }
-    }
-    std::cout << treeCount << "\t" << fireCount << std::endl;
+    std::cout << observables.trees << "\t" << observables.fires << std::endl;
 }
 
 void init() {
     glClearColor(colors[EMPTY][0], colors[EMPTY][1], colors[EMPTY][2], 0.0f);
-    std::srand(std::time(0));
+    randomEvents.set_seed((SEED != 0) ? SEED : std::time(0));
+    std::cout << "seed " << randomEvents.seed << std::endl;
     init_grid(ALL_NEIGHBORS);
 }
 
 void display_callback() {
+    ScopedTimer frameTimer(&frameTime);
+    const Grid & shown(replay.is_open() ? grid : simulation.snapshot());
     glClear (GL_COLOR_BUFFER_BIT);
-
-    draw_grid();
-
-    glFlush();
-    glutSwapBuffers();
+    {
+        ScopedTimer drawTimer(&drawTime);
+        if (RENDERER == VERTEX_BUFFER)
+            renderer.draw(shown);
+        else
+            draw_grid(shown);
+    }
+    {
+        ScopedTimer swapTimer(&swapTime);
+        glFlush();
+        glutSwapBuffers();
+    }
+    frames.add();
 }
 
 void reshape_callback(int width, int height) {
@@ -213,29 +236,62 @@ void reshape_callback(int width, int height) {
     glMatrixMode(GL_MODELVIEW);
 }
 
-void timer_callback(int) {
-    auto start(std::chrono::steady_clock::now());
+void dump_metrics() {
+    metrics.dump("Metrics_tri");
+}
 
-    next_step();
-    //stats();
-    glutPostRedisplay(); // run the display_callback function
+bool open_replay(const char * path) {
+    if (!replay.open(path))
+        return false;
+    if (replay.rows != ROWS || replay.cols != COLUMNS) {
+        std::cerr << "the recording is " << replay.rows << "x" << replay.cols
+                  << ", not " << ROWS << "x" << COLUMNS << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    auto stop(std::chrono::steady_clock::now());
-    auto duration(std::chrono::duration_cast<std::chrono::milliseconds>(stop-start));
-    glutTimerFunc(std::abs(1000.0/FPS - duration.count()), timer_callback, 0);
+void show_replay() {
+    replay.show(grid);
+    std::string title("step " + std::to_string(replay.step()));
+    glutSetWindowTitle(title.c_str());
+}
+
+// space: pause, r: reverse, +/-: speed, ./,: one frame, 0-9: seek
+void keyboard_callback(unsigned char key, int, int) {
+    if (replay.is_open() && replay.key(key))
+        show_replay();
+}
+
+void timer_callback(int) {
+    // the steps are done by the simulation thread
+    static int ticks(0);
+    if (replay.is_open() && replay.tick())
+        show_replay();
+    if (Metrics::dump_requested())
+        dump_metrics();
+    if (METRICS_TITLE && ++ticks % FPS == 0)
+        glutSetWindowTitle(metrics.overlay().c_str());
+    glutPostRedisplay(); // run the display_callback function
+    glutTimerFunc(1000/FPS, timer_callback, 0);
 }
 
 
 int main(int argc, char **argv) {
     glutInit(&argc, argv); // initialize
+    if (argc > 2 && std::string(argv[1]) == "--replay" && !open_replay(argv[2]))
+        return 1;
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
     glutInitWindowPosition(15, 15); // optional
     glutInitWindowSize(COLUMNS*CELL_SIZE, ROWS*CELL_SIZE*sin60);
     glutCreateWindow("Forest fire simulation with triangular tiling");
     glutDisplayFunc(display_callback);
     glutReshapeFunc(reshape_callback);
+    glutKeyboardFunc(keyboard_callback);
     glutTimerFunc(1000/FPS, timer_callback, 0);
     init(EMPTY, ALL_NEIGHBORS);
+    Metrics::dump_on_signal(SIGUSR1);
+    std::atexit(dump_metrics);
     glutMainLoop();
 
     return 0;